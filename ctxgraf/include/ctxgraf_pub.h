@@ -34,6 +34,22 @@ enum PixelFormat
 };
 
 
+/**
+ * An enumeration for the ways ctxgraf can lay out the memory of a surface.
+ */
+enum SurfaceLayout
+{
+    SL_PACKED,       ///< each row starts right after the one before it
+    SL_ALIGNED,      ///< each row starts on a 64 byte boundary, and there are
+                     ///< at least 64 writable bytes past the end of the last row
+    SL_TILED,        ///< pixels are kept in small square tiles, so that pixels that
+                     ///< are close together are close in memory; getStart() and
+                     ///< lockRect() hand out copies in row order
+
+    SL_COUNT
+};
+
+
 /**
  * An object representing a single color.
  */
@@ -42,7 +58,7 @@ struct Color
     uint8_t red;
     uint8_t green;
     uint8_t blue;
-    uint8_t alpha;    ///< (may be ignored in some cases)
+    uint8_t alpha;    ///< (only stored by PF_RGBA_8888 surfaces; ignored in other cases)
 
     Color() : red(0), green(0), blue(0), alpha(255) {}
 
@@ -101,6 +117,24 @@ struct Vertex
 };
 
 
+/**
+ * A rectangle of pixels on a surface.
+ */
+struct Rect
+{
+    int32_t x, y;               ///< top left pixel
+    uint32_t width, height;     ///< size in pixels
+
+    Rect()
+        : x(0), y(0), width(0), height(0)
+    {}
+
+    Rect(int32_t _x, int32_t _y, uint32_t _width, uint32_t _height)
+        : x(_x), y(_y), width(_width), height(_height)
+    {}
+};
+
+
 /* A few well-known ROPs for the bitBlt() method */
 
 static const uint8_t BITBLT_ROP_BLACKNESS = 0x0;
@@ -187,17 +221,61 @@ public:
 
     /**
      * Set the pixel at (x,y) to pixelColor.
+     * Alpha is only stored if the surface format has it (PF_RGBA_8888).
      * If (x,y) is outside the surface boundaries, do nothing.
      */
     virtual void drawPixel(uint32_t x, uint32_t y, Color pixelColor) = 0;
 
     /**
      * Return the color value of the pixel at (x,y).
+     * Alpha is 255 if the surface format doesn't have it.
      *
      * @throw BadParameterException if (x,y) is outside the surface boundaries.
      */
     virtual Color getPixel(uint32_t x, uint32_t y) const = 0;
 
+    /**
+     * Set the count pixels starting at (x,y) and going right to colors[0] ... colors[count-1].
+     * Pixels outside the surface boundaries are skipped, as with drawPixel().
+     *
+     * @throws ParameterException if colors is NULL.
+     */
+    virtual void drawSpan(uint32_t x, uint32_t y, uint32_t count, const Color* colors) = 0;
+
+    /**
+     * Set the count pixels starting at (x,y) and going right to pixelColor.
+     * Pixels outside the surface boundaries are skipped, as with drawPixel().
+     */
+    virtual void fillSpan(uint32_t x, uint32_t y, uint32_t count, Color pixelColor) = 0;
+
+    /**
+     * Read the count pixels starting at (x,y) and going right into colors[0] ... colors[count-1].
+     *
+     * @throws ParameterException if colors is NULL, or any of the pixels is outside the surface boundaries.
+     */
+    virtual void readSpan(uint32_t x, uint32_t y, uint32_t count, Color* colors) const = 0;
+
+    /**
+     * Get direct access to a rectangle of pixels, in the surface's pixel format.
+     * Returns a pointer to the pixel at (x,y); each following row of the rectangle
+     * starts pitch bytes after the one before it.  The pointer is good until
+     * unlockRect() is called, which must be done before the surface is used any other way.
+     * For an SL_TILED surface the pointer is to a copy of the rectangle in row
+     * order, which unlockRect() puts back.
+     *
+     * @param[out] pitch Set to the distance between rows, in bytes.
+     *
+     * @throws ParameterException if the rectangle is empty or not entirely inside the surface.
+     * @throws BadStateException if a rectangle is already locked.
+     */
+    virtual void* lockRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t& pitch) = 0;
+
+    /**
+     * End direct access to the rectangle from lockRect().
+     * Does nothing if no rectangle is locked.
+     */
+    virtual void unlockRect() = 0;
+
     /**
      * Perform a BitBlt operation with this surface as the destination.
      *
@@ -227,11 +305,15 @@ public:
 
     /**
      * Return a pointer to surface memory.
+     * Rows are getPitch() bytes apart.  For an SL_TILED surface, this is a copy
+     * of the pixels in row order, made when getStart() is called; changing it
+     * doesn't change the surface (use lockRect() for that).
      */
     virtual void* getStart() = 0;
 
     /**
      * Return a pointer to surface memory (const version).
+     * See the non-const version for SL_TILED surfaces.
      */
     virtual const void* getStart() const = 0;
 
@@ -255,6 +337,11 @@ public:
      */
     virtual PixelFormat getFormat() const = 0;
 
+    /**
+     * Return the memory layout of the surface.
+     */
+    virtual SurfaceLayout getLayout() const = 0;
+
 protected:
 
     /**
@@ -295,6 +382,22 @@ public:
     */
     virtual uint32_t getZ(uint32_t x, uint32_t y) const = 0;
 
+    /**
+    * Set the count pixels starting at (x,y) and going right to zValues[0] ... zValues[count-1].
+    * Pixels outside the surface boundaries are skipped, as with setZ().
+    *
+    * @throws ParameterException if zValues is NULL or any of the values is too big.
+    * Nothing is written in that case.
+    */
+    virtual void setZSpan(uint32_t x, uint32_t y, uint32_t count, const uint32_t* zValues) = 0;
+
+    /**
+    * Read the Z values of the count pixels starting at (x,y) and going right into zValues[0] ... zValues[count-1].
+    *
+    * @throws ParameterException if zValues is NULL, or any of the pixels is outside the surface boundaries.
+    */
+    virtual void getZSpan(uint32_t x, uint32_t y, uint32_t count, uint32_t* zValues) const = 0;
+
     /**
     * Return the width of the surface (in pixels).
     */
@@ -315,6 +418,11 @@ public:
     */
     virtual PixelFormat getFormat() const = 0;
 
+    /**
+    * Return the memory layout of the surface.
+    */
+    virtual SurfaceLayout getLayout() const = 0;
+
 protected:
 
     /**
@@ -363,6 +471,54 @@ enum TextureFilteringMode
     TEXTURE_FILTERING_MODE_COUNT
 };
 
+/** Available functions for blending triangle pixels into the drawing surface */
+enum BlendFunction
+{
+    BLEND_FUNCTION_NONE,        ///< replace the surface pixel
+    BLEND_FUNCTION_SOURCE_OVER, ///< c = c_src * a_src + c_dst * (1 - a_src), a = a_src + a_dst * (1 - a_src)
+    BLEND_FUNCTION_ADDITIVE,    ///< c = c_src * a_src + c_dst, a = a_src + a_dst, saturated
+
+    BLEND_FUNCTION_COUNT
+};
+
+/** Available modes for rendering triangle batches */
+enum RenderMode
+{
+    RENDER_MODE_IMMEDIATE,  ///< draw batched triangles one at a time, in order, on the calling thread
+    RENDER_MODE_TILED,      ///< bin batched triangles into screen tiles and rasterize the tiles in parallel
+    RENDER_MODE_SORT_LAST,  ///< split batched triangles between threads with private color and Z targets, then merge those by depth
+
+    RENDER_MODE_COUNT
+};
+
+/** Available modes for discarding triangles by the way they face */
+enum CullMode
+{
+    CULL_NONE,      ///< draw all triangles
+    CULL_BACK,      ///< don't draw triangles that face away
+    CULL_FRONT,     ///< don't draw triangles that face forward
+
+    CULL_MODE_COUNT
+};
+
+/** Available vertex orders for front-facing triangles */
+enum FrontFace
+{
+    FRONT_FACE_COUNTER_CLOCKWISE,   ///< triangles whose vertices go counter-clockwise face forward
+    FRONT_FACE_CLOCKWISE,           ///< triangles whose vertices go clockwise face forward
+
+    FRONT_FACE_COUNT
+};
+
+/** Available modes for placing vertices on the pixel grid */
+enum RasterMode
+{
+    RASTER_MODE_PIXEL,      ///< snap vertices to whole pixels and rasterize in floating point
+    RASTER_MODE_SUBPIXEL,   ///< keep vertices in 28.4 fixed point and rasterize with integer math and a top-left fill rule
+
+    RASTER_MODE_COUNT
+};
+
 /**
  * The interface to a drawing context.
  * A drawing context contains the logic for drawing 3D primitives (lines and triangles),
@@ -383,10 +539,32 @@ public:
      * @param[in] vertices The array of vertices in the polyline.
      * @param[in] vertexCount The number of vertices in the array.
      *
+     * With LINE_SHADING_MODE_CONSTANT, a polyline with many more vertices than the clip rectangle
+     * has pixel columns is first decimated to the vertices that change which pixels are covered.
+     * With LINE_SHADING_MODE_SMOOTH every vertex is drawn, so that no vertex color is lost.
+     *
      * @throws ParameterException if vertices is NULL, or vertexCount < 2.
      */
     virtual void polyline(ISurface* drawingSurface, const Vertex* vertices, uint32_t vertexCount) const = 0;
 
+    /**
+     * Draw a batch of independent polylines.
+     * Polyline i uses vertices[offsets[i]] up to but not including vertices[offsets[i+1]],
+     * so offsets has polylineCount + 1 entries. Polylines with fewer than 2 vertices draw nothing.
+     * The result is the same as calling polyline() for each polyline in order, but the
+     * segments are drawn in parallel, each thread owning a band of surface rows.
+     * Long polylines are decimated under the same shading mode rule as in polyline().
+     *
+     * @param[in] drawingSurface The surface to draw into.
+     * @param[in] vertices The array of vertices. Every offset must be a valid position in it, or its end.
+     * @param[in] offsets The array of polylineCount + 1 vertex offsets, in increasing order.
+     * @param[in] polylineCount The number of polylines in the batch.
+     *
+     * @throws ParameterException if drawingSurface, vertices or offsets is NULL,
+     * or the offsets decrease.
+     */
+    virtual void polylines(ISurface* drawingSurface, const Vertex* vertices, const uint32_t* offsets, uint32_t polylineCount) const = 0;
+
     /**
      * Set the constant line color.
      * This color is used for all lines if LINE_SHADING_MODE_CONSTANT is being used.
@@ -428,6 +606,165 @@ public:
      */
     virtual void triangle(ISurface* drawingSurface, IZBuffer* zBuffer, const Vertex* v1, const Vertex* v2, const Vertex* v3) const = 0;
 
+    /**
+     * Draw a batch of independent triangles.
+     * Triangle i uses vertices[3*i], vertices[3*i+1] and vertices[3*i+2].
+     * The result is the same as calling triangle() for each triangle in order;
+     * the render mode decides how the work is actually done.
+     *
+     * @param[in] drawingSurface The surface to draw into.
+     * @param[in] zBuffer The Z buffer to use. (May be null for no Z buffering)
+     * @param[in] vertices The array of 3 * triangleCount vertices.
+     * @param[in] triangleCount The number of triangles in the batch.
+     *
+     * @throws ParameterException if drawingSurface or vertices is NULL.
+     */
+    virtual void triangleList(ISurface* drawingSurface, IZBuffer* zBuffer, const Vertex* vertices, uint32_t triangleCount) const = 0;
+
+    /**
+     * Draw an indexed list of triangles.
+     * Triangle i uses vertices[indices[3*i]], vertices[indices[3*i+1]] and vertices[indices[3*i+2]];
+     * leftover indices (if indexCount isn't a multiple of 3) are ignored.
+     * Vertices shared between triangles are only transformed once while they stay in a small cache,
+     * so meshes should list triangles that share vertices close together.
+     * Batches are drawn according to the current render mode.
+     *
+     * @param[in] drawingSurface The surface to draw into.
+     * @param[in] zBuffer The Z buffer to use. (May be null for no Z buffering)
+     * @param[in] vertices The array of vertices. Every index must be a valid position in it.
+     * @param[in] indices The array of vertex indices.
+     * @param[in] indexCount The number of indices in the array.
+     *
+     * @throws ParameterException if drawingSurface, vertices or indices is NULL.
+     */
+    virtual void drawIndexed(ISurface* drawingSurface, IZBuffer* zBuffer, const Vertex* vertices, const uint32_t* indices, uint32_t indexCount) const = 0;
+
+    /**
+     * Draw a triangle strip.
+     * Triangle i uses vertices[i], vertices[i+1] and vertices[i+2] (with the first two
+     * swapped for odd i, so that all triangles wind the same way).
+     * Each vertex is only converted to surface coordinates once.
+     * Strips are drawn according to the current render mode.
+     *
+     * @param[in] drawingSurface The surface to draw into.
+     * @param[in] zBuffer The Z buffer to use. (May be null for no Z buffering)
+     * @param[in] vertices The array of vertices in the strip.
+     * @param[in] vertexCount The number of vertices in the array.
+     *
+     * @throws ParameterException if drawingSurface or vertices is NULL, or vertexCount < 3.
+     */
+    virtual void triangleStrip(ISurface* drawingSurface, IZBuffer* zBuffer, const Vertex* vertices, uint32_t vertexCount) const = 0;
+
+    /**
+     * Draw a triangle fan.
+     * Triangle i uses vertices[0] (the center), vertices[i+1] and vertices[i+2].
+     * Each vertex is only converted to surface coordinates once.
+     * Fans are drawn according to the current render mode.
+     *
+     * @param[in] drawingSurface The surface to draw into.
+     * @param[in] zBuffer The Z buffer to use. (May be null for no Z buffering)
+     * @param[in] vertices The array of vertices in the fan, starting with the center.
+     * @param[in] vertexCount The number of vertices in the array.
+     *
+     * @throws ParameterException if drawingSurface or vertices is NULL, or vertexCount < 3.
+     */
+    virtual void triangleFan(ISurface* drawingSurface, IZBuffer* zBuffer, const Vertex* vertices, uint32_t vertexCount) const = 0;
+
+    /**
+     * Set the render mode used for triangle batches.
+     * RENDER_MODE_SORT_LAST needs depth to merge by, so batches drawn without a Z buffer
+     * are rendered as in RENDER_MODE_TILED. Its private targets belong to the context, so
+     * RENDER_MODE_SORT_LAST batches drawn through one context from several threads take turns.
+     * It defaults to RENDER_MODE_IMMEDIATE.
+     *
+     * @throws ParameterException if mode is invalid.
+     */
+    virtual void setRenderMode(RenderMode mode) = 0;
+
+    /**
+     * Return the current render mode.
+     */
+    virtual RenderMode getRenderMode() const = 0;
+
+    /**
+     * Set the raster mode used for triangles and lines.
+     * RASTER_MODE_SUBPIXEL produces the same pixels no matter how a primitive is split
+     * up for drawing (for example across render tiles).
+     * It defaults to RASTER_MODE_PIXEL.
+     *
+     * @throws ParameterException if mode is invalid.
+     */
+    virtual void setRasterMode(RasterMode mode) = 0;
+
+    /**
+     * Return the current raster mode.
+     */
+    virtual RasterMode getRasterMode() const = 0;
+
+    /**
+     * Set the cull mode.
+     * Triangles with no area are never drawn, whatever the cull mode.
+     * It defaults to CULL_NONE.
+     *
+     * @throws ParameterException if mode is invalid.
+     */
+    virtual void setCullMode(CullMode mode) = 0;
+
+    /**
+     * Return the current cull mode.
+     */
+    virtual CullMode getCullMode() const = 0;
+
+    /**
+     * Set which vertex order (as seen with x to the right and y up) makes a triangle front-facing.
+     * It defaults to FRONT_FACE_COUNTER_CLOCKWISE.
+     *
+     * @throws ParameterException if frontFace is invalid.
+     */
+    virtual void setFrontFace(FrontFace frontFace) = 0;
+
+    /**
+     * Return the current front face vertex order.
+     */
+    virtual FrontFace getFrontFace() const = 0;
+
+    /**
+     * Set the viewport: the rectangle of the drawing surface that vertex coordinates
+     * in [-1.0, 1.0] are mapped onto. Nothing is drawn outside of it.
+     * It defaults to NULL, which means the whole drawing surface.
+     *
+     * @param[in] viewport The new viewport, or NULL for the whole drawing surface.
+     *
+     * @throws ParameterException if viewport has a zero width or height.
+     */
+    virtual void setViewport(const Rect* viewport) = 0;
+
+    /**
+     * Return the current viewport.
+     *
+     * @param[out] viewport Set to the viewport, if one has been set.
+     *
+     * @return false if the viewport is the whole drawing surface.
+     */
+    virtual bool getViewport(Rect& viewport) const = 0;
+
+    /**
+     * Set the scissor rectangle. Triangles and lines only draw pixels inside of it.
+     * It defaults to NULL (i.e. no scissor rectangle).
+     *
+     * @param[in] scissor The new scissor rectangle, or NULL for none.
+     */
+    virtual void setScissor(const Rect* scissor) = 0;
+
+    /**
+     * Return the current scissor rectangle.
+     *
+     * @param[out] scissor Set to the scissor rectangle, if one has been set.
+     *
+     * @return false if there is no scissor rectangle.
+     */
+    virtual bool getScissor(Rect& scissor) const = 0;
+
     /**
      * Set the texture map to use for drawing triangles.
      * It defaults to NULL (i.e. no texture map).
@@ -476,6 +813,34 @@ public:
      */
     virtual TextureFilteringMode getTextureFilteringMode() const = 0;
 
+    /**
+     * Set the function that combines triangle pixels with the pixels already in the drawing surface.
+     * The source alpha is the interpolated vertex alpha (after texture blending); surfaces without
+     * alpha act as if theirs were always 255. Lines are never blended.
+     * Blended batches are drawn in order, so RENDER_MODE_SORT_LAST batches are rendered as in RENDER_MODE_TILED.
+     * It defaults to BLEND_FUNCTION_NONE.
+     *
+     * @throws ParameterException if function is invalid.
+     */
+    virtual void setBlendFunction(BlendFunction function) = 0;
+
+    /**
+     * Return the current blend function.
+     */
+    virtual BlendFunction getBlendFunction() const = 0;
+
+    /**
+     * Set the alpha test threshold.  Triangle pixels whose alpha is less than threshold
+     * are discarded before they get to the Z buffer or the blend function.
+     * It defaults to 0 (i.e. no alpha test).
+     */
+    virtual void setAlphaTestThreshold(uint8_t threshold) = 0;
+
+    /**
+     * Return the current alpha test threshold.
+     */
+    virtual uint8_t getAlphaTestThreshold() const = 0;
+
 protected:
 
     /**
@@ -503,13 +868,15 @@ public:
      * @param[in] format The pixel format of the new surface.
      * @param[in] width The width of the new surface (in pixels).
      * @param[in] height The height of the new surface (in pixels).
+     * @param[in] layout The memory layout of the new surface.
      * @return The newly-created surface object.
      *
-     * @throws ParameterException if format is invalid, or width or height
-     * is zero.
+     * @throws ParameterException if format or layout is invalid, or width or
+     * height is zero.
      */
     virtual ISurface* createSurface(PixelFormat format,
-                                    uint32_t width, uint32_t height) = 0;
+                                    uint32_t width, uint32_t height,
+                                    SurfaceLayout layout = SL_PACKED) = 0;
 
     /**
      * Create and return a new drawing context object.
@@ -523,11 +890,13 @@ public:
      *
      * @param[in] width The width of the new surface (in pixels).
      * @param[in] height The height of the new surface (in pixels).
+     * @param[in] layout The memory layout of the new surface.
      * @return The newly-created Z buffer object.
      *
-     * @throws ParameterException if width or height is zero.
+     * @throws ParameterException if layout is invalid, or width or height is zero.
      */
-    virtual IZBuffer* createZBuffer(uint32_t width, uint32_t height) = 0;
+    virtual IZBuffer* createZBuffer(uint32_t width, uint32_t height,
+                                    SurfaceLayout layout = SL_PACKED) = 0;
 
 protected:
 
@@ -17,6 +17,7 @@ Surface::Surface(PixelFormat format, uint32_t width, uint32_t height)
     , m_width(width)
     , m_height(height)
     , m_pitch(0)
+    , m_locked(false)
 {
     if (width == 0 || height == 0)
         throw ParameterException("invalid width or height");
@@ -53,6 +54,8 @@ void Surface::drawPixel(uint32_t x, uint32_t y, Color pixelColor)
         *loc++ = pixelColor.red;
         *loc++ = pixelColor.green;
         *loc++ = pixelColor.blue;
+        if (m_format == PF_RGBA_8888)
+            *loc = pixelColor.alpha;
     }
 }
 
@@ -70,10 +73,56 @@ Color Surface::getPixel(uint32_t x, uint32_t y) const
     result.red   = *loc++;
     result.green = *loc++;
     result.blue  = *loc++;
+    if (m_format == PF_RGBA_8888)
+        result.alpha = *loc;
 
     return result;
 }
 
+void Surface::drawSpan(uint32_t x, uint32_t y, uint32_t count, const Color* colors)
+{
+    if (!colors)
+        throw ParameterException("NULL colors in drawSpan");
+
+    for (uint32_t i = 0; i < count && x + i < m_width; i++)
+        drawPixel(x + i, y, colors[i]);
+}
+
+void Surface::fillSpan(uint32_t x, uint32_t y, uint32_t count, Color pixelColor)
+{
+    for (uint32_t i = 0; i < count && x + i < m_width; i++)
+        drawPixel(x + i, y, pixelColor);
+}
+
+void Surface::readSpan(uint32_t x, uint32_t y, uint32_t count, Color* colors) const
+{
+    if (!colors)
+        throw ParameterException("NULL colors in readSpan");
+    if (x >= m_width || count > m_width - x)
+        throw ParameterException("illegal span to readSpan");
+
+    for (uint32_t i = 0; i < count; i++)
+        colors[i] = getPixel(x + i, y);
+}
+
+void* Surface::lockRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t& pitch)
+{
+    if (m_locked)
+        throw BadStateException("lockRect called while a rectangle is already locked");
+    if (width == 0 || height == 0 || x >= m_width || y >= m_height ||
+        width > m_width - x || height > m_height - y)
+        throw ParameterException("illegal rectangle to lockRect");
+
+    m_locked = true;
+    pitch = m_pitch;
+    return m_surface + (y * m_pitch) + (x * bytesPerPixel());
+}
+
+void Surface::unlockRect()
+{
+    m_locked = false;
+}
+
 
 void Surface::bitBlt(uint32_t width, uint32_t height,
     uint32_t dstX, uint32_t dstY,
@@ -234,6 +283,11 @@ PixelFormat Surface::getFormat() const
     return m_format;
 }
 
+SurfaceLayout Surface::getLayout() const
+{
+    return SL_PACKED;
+}
+
 void Surface::clear(uint32_t clearValue)
 {
     for (uint32_t y = 0; y < m_height; y++)
@@ -269,6 +323,31 @@ uint32_t Surface::getZ(uint32_t x, uint32_t y) const
     return *loc;
 }
 
+void Surface::setZSpan(uint32_t x, uint32_t y, uint32_t count, const uint32_t* zValues)
+{
+    if (!zValues)
+        throw ParameterException("NULL zValues in setZSpan");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (zValues[i] > 0xFFFF)
+            throw ParameterException("Z value is too big in setZSpan");
+    }
+
+    for (uint32_t i = 0; i < count && x + i < m_width; i++)
+        setZ(x + i, y, zValues[i]);
+}
+
+void Surface::getZSpan(uint32_t x, uint32_t y, uint32_t count, uint32_t* zValues) const
+{
+    if (!zValues)
+        throw ParameterException("NULL zValues in getZSpan");
+    if (x >= m_width || count > m_width - x)
+        throw ParameterException("illegal span to getZSpan");
+
+    for (uint32_t i = 0; i < count; i++)
+        zValues[i] = getZ(x + i, y);
+}
+
 unsigned Surface::bytesPerPixel() const
 {
     switch (m_format)
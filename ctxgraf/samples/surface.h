@@ -18,6 +18,11 @@ public:
     virtual void clear(Color clearColor);
     virtual void drawPixel(uint32_t x, uint32_t y, Color pixelColor);
     virtual Color getPixel(uint32_t x, uint32_t y) const;
+    virtual void drawSpan(uint32_t x, uint32_t y, uint32_t count, const Color* colors);
+    virtual void fillSpan(uint32_t x, uint32_t y, uint32_t count, Color pixelColor);
+    virtual void readSpan(uint32_t x, uint32_t y, uint32_t count, Color* colors) const;
+    virtual void* lockRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t& pitch);
+    virtual void unlockRect();
     virtual void bitBlt(uint32_t width, uint32_t height,
                         uint32_t dstX, uint32_t dstY,
                         const ISurface* src, uint32_t srcX, uint32_t srcY,
@@ -28,11 +33,14 @@ public:
     virtual uint32_t getHeight() const;
     virtual uint32_t getPitch() const;
     virtual PixelFormat getFormat() const;
+    virtual SurfaceLayout getLayout() const;
 
     // Extra IZBuffer methods
     virtual void clear(uint32_t clearValue);
     virtual void setZ(uint32_t x, uint32_t y, uint32_t zValue);
     virtual uint32_t getZ(uint32_t x, uint32_t y) const;
+    virtual void setZSpan(uint32_t x, uint32_t y, uint32_t count, const uint32_t* zValues);
+    virtual void getZSpan(uint32_t x, uint32_t y, uint32_t count, uint32_t* zValues) const;
 
 protected:
 
@@ -41,6 +49,7 @@ protected:
     uint32_t m_width;
     uint32_t m_height;
     uint32_t m_pitch;
+    bool m_locked;
 
     /** Return the bytes per pixel required by this object's pixel format (m_format) */
     unsigned bytesPerPixel() const;
@@ -20,8 +20,12 @@
 namespace ctxgraf {
 
 
-ISurface* Top::createSurface(PixelFormat format, uint32_t width, uint32_t height)
+ISurface* Top::createSurface(PixelFormat format, uint32_t width, uint32_t height,
+                             SurfaceLayout layout)
 {
+    if (layout != SL_PACKED)
+        throw NotImplementedException("unsupported surface layout");
+
     return new Surface(format, width, height);
 }
 
@@ -30,8 +34,11 @@ IDrawingContext* Top::createDrawingContext()
     return new DrawingContext();
 }
 
-IZBuffer* Top::createZBuffer(uint32_t width, uint32_t height)
+IZBuffer* Top::createZBuffer(uint32_t width, uint32_t height, SurfaceLayout layout)
 {
+    if (layout != SL_PACKED)
+        throw NotImplementedException("unsupported surface layout");
+
     return new Surface(PF_Z16, width, height);
 }
 
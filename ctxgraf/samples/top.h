@@ -27,9 +27,11 @@ public:
     virtual ~Top() {}
 
     // ITop methods
-    virtual ISurface* createSurface(PixelFormat format, uint32_t width, uint32_t height);
+    virtual ISurface* createSurface(PixelFormat format, uint32_t width, uint32_t height,
+                                    SurfaceLayout layout = SL_PACKED);
     virtual IDrawingContext* createDrawingContext();
-    virtual IZBuffer* createZBuffer(uint32_t width, uint32_t height);
+    virtual IZBuffer* createZBuffer(uint32_t width, uint32_t height,
+                                    SurfaceLayout layout = SL_PACKED);
 };
 
 } // namespace ctxgraf
@@ -10,7 +10,7 @@
 /**
  * @file bitblt_test.cpp
  * This is the main program for an executable that tests ISurface::bitBlt(),
- * ISurface::drawPixel(), and ISurface::clear()
+ * ISurface::drawPixel(), ISurface::clear() and the span accessors
  */
 
 static const unsigned IMAGE_WIDTH = 640;
@@ -21,6 +21,8 @@ using namespace ctxgraf;
 
 /** Separate source surface for tests that need it */
 static ISurface* s_srcSurface = nullptr;
+/** Tiled surface for tests that need one */
+static ISurface* s_tiledSurface = nullptr;
 static unsigned s_testNumber = 0;
 static bool s_exceptionSeen = false;
 
@@ -37,6 +39,8 @@ enum TEST_ID
     TID_CLIP,
     TID_ZERO_SIZES,
     TID_ALL_ROPS,
+    TID_EVERY_ROP,
+    TID_SPANS,
 
     TID_TEST_COUNT
 };
@@ -54,6 +58,8 @@ static const char* s_testStrings[TID_TEST_COUNT] =
     "BitBlt: clip",
     "BitBlt: zero sizes",
     "BitBlt: all rops",
+    "BitBlt: each of the 16 rops, from a shifted source",
+    "Spans: drawSpan, fillSpan, readSpan and lockRect",
 };
 
 /**
@@ -256,6 +262,64 @@ static void drawSurface(ISurface* surface, unsigned frame)
             break;
         }
 
+        case TID_EVERY_ROP:
+        {
+            // Rop i goes in row i / 4, column i % 4. The source is the same test
+            // rectangle as the destination, moved a quarter of the way down and right.
+            static const uint32_t SIZE = 100;
+            s_srcSurface->clear(Color(0, 0, 0));
+            drawTestRectangle(s_srcSurface, 100, 100, SIZE, SIZE);
+            for (uint8_t rop = 0; rop < 16; rop++)
+            {
+                const uint32_t left = 30 + 150 * (rop % 4), top = 10 + 118 * (rop / 4);
+                drawTestRectangle(surface, left, top, SIZE, SIZE);
+                surface->bitBlt(SIZE, SIZE, left, top, s_srcSurface, 100 - SIZE / 4, 100 - SIZE / 4, rop);
+
+                // Blits to and from a tiled surface that clip to zero width must not draw anything
+                s_tiledSurface->bitBlt(SIZE, SIZE, IMAGE_WIDTH, top, surface, left, top, rop);
+                surface->bitBlt(SIZE, SIZE, IMAGE_WIDTH, top, s_tiledSurface, left, top, rop);
+            }
+            break;
+        }
+
+        case TID_SPANS:
+        {
+            // A gradient that runs off the right edge, drawn a row at a time
+            Color row[IMAGE_WIDTH];
+            for (uint32_t y = 0; y < 150; y++)
+            {
+                for (uint32_t x = 0; x < IMAGE_WIDTH; x++)
+                    row[x] = Color(static_cast<uint8_t>(x), static_cast<uint8_t>(y), 255);
+                surface->drawSpan(IMAGE_WIDTH - 256, y + 20, IMAGE_WIDTH, row);
+            }
+
+            // Bars of solid color, each one shorter than the one above it
+            for (uint32_t y = 0; y < 150; y++)
+                surface->fillSpan(20, y + 20, 300 - 2 * y, Color(255, (y / 10) * 17, 0));
+
+            // A test rectangle, copied a row at a time and mirrored left to right
+            drawTestRectangle(surface, 20, 250, 200, 150);
+            for (uint32_t y = 0; y < 150; y++)
+            {
+                Color mirrored[200];
+                surface->readSpan(20, y + 250, 200, row);
+                for (uint32_t x = 0; x < 200; x++)
+                    mirrored[x] = row[199 - x];
+                surface->drawSpan(240, y + 250, 200, mirrored);
+            }
+
+            // The mirrored copy's right half, inverted through direct access
+            uint32_t pitch = 0;
+            uint8_t* start = static_cast<uint8_t*>(surface->lockRect(340, 250, 100, 150, pitch));
+            for (uint32_t y = 0; y < 150; y++)
+            {
+                for (uint32_t x = 0; x < 100 * 3; x++)
+                    start[y * pitch + x] = ~start[y * pitch + x];
+            }
+            surface->unlockRect();
+            break;
+        }
+
         default:
             fprintf(stderr, "Unknown test id: %d\n", s_testNumber);
             getchar();
@@ -298,6 +362,7 @@ int main(int argc, char** argv)
         ITop* top = getTop();
         ISurface* surface = top->createSurface(PF_RGB_888, IMAGE_WIDTH, IMAGE_HEIGHT);
         s_srcSurface = top->createSurface(PF_RGB_888, IMAGE_WIDTH, IMAGE_HEIGHT);
+        s_tiledSurface = top->createSurface(PF_RGB_888, IMAGE_WIDTH, IMAGE_HEIGHT, SL_TILED);
         Viewer* viewer = Viewer::createViewer(surface);
 
         viewer->start(drawSurface);
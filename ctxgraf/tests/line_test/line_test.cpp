@@ -38,6 +38,9 @@ enum TEST_ID
     TID_RECTANGLE_SMOOTH,
     TID_CIRCLE_SMOOTH,
     TID_CLIP,
+    TID_CIRCLE_SUBPIXEL,
+    TID_POLYLINES,
+    TID_TIME_SERIES,
 
     TID_TEST_COUNT
 };
@@ -56,6 +59,9 @@ static const char* s_testStrings[TID_TEST_COUNT] =
     "Draw a centered rectangle with smooth shading",
     "Draw a counter-clockwise circle with smooth shading",
     "Draw a polyline that needs clipping",
+    "Draw a slowly rotating circle with smooth shading and subpixel precision",
+    "Draw a grid of small polylines, and a cross over them, in one batch",
+    "Draw a noisy time series with far more points than pixel columns",
 };
 
 
@@ -254,6 +260,80 @@ static void drawSurface(ISurface* surface, unsigned frame)
             break;
         }
 
+        case TID_CIRCLE_SUBPIXEL:
+        {
+            static const float RADIUS = 0.7f;
+            static const unsigned COUNT = 36;
+            static const double FRAME_ANGLE_DELTA = 0.002;
+            Vertex vtx[COUNT + 1];
+
+            const double angleDelta = 2.0 * M_PI / COUNT;
+            setCircularVertexPattern(vtx, COUNT + 1, RADIUS, angleDelta, frame * FRAME_ANGLE_DELTA);
+
+            s_context->setRasterMode(RASTER_MODE_SUBPIXEL);
+            s_context->setLineShadingMode(LINE_SHADING_MODE_SMOOTH);
+            s_context->polyline(surface, vtx, COUNT + 1);
+            break;
+        }
+
+        case TID_POLYLINES:
+        {
+            // Each grid cell gets its own short zigzag; the last two polylines are a
+            // horizontal and a vertical line through the whole grid, drawn on top.
+            static const unsigned GRID = 40;
+            static const unsigned ZIGZAG = 4;
+            static Vertex vtx[GRID * GRID * ZIGZAG + 4];
+            static uint32_t offsets[GRID * GRID + 3];
+
+            unsigned count = 0, polylineCount = 0;
+            for (unsigned row = 0; row < GRID; row++)
+            {
+                for (unsigned column = 0; column < GRID; column++)
+                {
+                    offsets[polylineCount++] = count;
+                    for (unsigned i = 0; i < ZIGZAG; i++)
+                    {
+                        Vertex& v = vtx[count++];
+                        v.x = -0.9f + 1.8f * (column + i / (float)(ZIGZAG - 1)) / GRID;
+                        v.y = -0.9f + 1.8f * (row + (i & 1) * 0.8f) / GRID;
+                        v.color = VertexColor(column / (float)GRID, 1.0f - row / (float)GRID, (float)(i & 1));
+                    }
+                }
+            }
+
+            offsets[polylineCount++] = count;
+            vtx[count].x = -0.95f; vtx[count].y = 0.0f; vtx[count++].color = VertexColor(1, 1, 1);
+            vtx[count].x = 0.95f; vtx[count].y = 0.0f; vtx[count++].color = VertexColor(1, 1, 1);
+            offsets[polylineCount++] = count;
+            vtx[count].x = 0.0f; vtx[count].y = -0.95f; vtx[count++].color = VertexColor(1, 1, 0);
+            vtx[count].x = 0.0f; vtx[count].y = 0.95f; vtx[count++].color = VertexColor(1, 1, 0);
+            offsets[polylineCount] = count;
+
+            s_context->setLineShadingMode(LINE_SHADING_MODE_SMOOTH);
+            s_context->polylines(surface, vtx, offsets, polylineCount);
+            break;
+        }
+
+        case TID_TIME_SERIES:
+        {
+            // A slow sine wave with noise on top, about 250 points per pixel column
+            static const unsigned COUNT = 200000;
+            static Vertex vtx[COUNT];
+
+            unsigned seed = 12345;
+            for (unsigned i = 0; i < COUNT; i++)
+            {
+                seed = seed * 1103515245 + 12345;
+                const double noise = ((seed >> 16) & 0x7FFF) / 32767.0 - 0.5;
+                vtx[i].x = (float)(-0.9 + 1.8 * i / (COUNT - 1));
+                vtx[i].y = (float)(0.5 * sin(6.0 * M_PI * i / COUNT) + 0.2 * noise * (1.0 + sin(2.0 * M_PI * i / COUNT)));
+            }
+
+            s_context->setLineColor(VertexColor(0.5f, 1.0f, 0.5f));
+            s_context->polyline(surface, vtx, COUNT);
+            break;
+        }
+
         default:
             fprintf(stderr, "Unknown test id: %d\n", s_testNumber);
             getchar();
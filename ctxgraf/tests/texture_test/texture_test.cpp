@@ -35,6 +35,7 @@ enum TEST_ID
     TID_WEIRD_SIZES,
     TID_BIG_CIRCLE,
     TID_BIG_CIRCLE_ROTATING,
+    TID_BIG_TEXTURE_LAYOUTS,
     TID_BAD_PARAMETERS,
 
     TID_TEST_COUNT
@@ -50,6 +51,7 @@ static const char* s_testStrings[TID_TEST_COUNT] =
     "Draw objects with interesting texture sizes",
     "Draw a big textured circle",
     "Draw a big textured circle that rotates",
+    "Draw two rotating circles with a big texture, stored row by row (left) and tiled (right)",
     "Ensure that state-setting calls with bad parameters throw exceptions",
 };
 
@@ -93,24 +95,46 @@ static ISurface* makeTestTexture(unsigned width, unsigned height)
 
     for (unsigned y = 0; y < height; y++)
     {
-        for (unsigned x = 0; x < width; x++)
+        if (y >= height / 2)
         {
-            if (width >= 4 && height >= 4)
-            {
-                if (x >= width / 4 && x < width * 3 / 4 && y >= height / 4 && y < height * 3 / 4)
-                {
-                    texture->drawPixel(x, y, middleColor);
-                    continue;
-                }
-            }
-
-            Color texelColor;
-            if (y >= height / 2)
-                texelColor = (x >= width / 2 ? lrColor : llColor);
-            else
-                texelColor = (x >= width / 2 ? urColor : ulColor);
-            texture->drawPixel(x, y, texelColor);
+            texture->fillSpan(0, y, width / 2, llColor);
+            texture->fillSpan(width / 2, y, width - width / 2, lrColor);
+        }
+        else
+        {
+            texture->fillSpan(0, y, width / 2, ulColor);
+            texture->fillSpan(width / 2, y, width - width / 2, urColor);
         }
+
+        if (width >= 4 && height >= 4 && y >= height / 4 && y < height * 3 / 4)
+            texture->fillSpan(width / 4, y, width * 3 / 4 - width / 4, middleColor);
+    }
+
+    return texture;
+}
+
+
+/**
+ * Create and return a big texture map with small squares of the test pattern colors,
+ * with the given memory layout.
+ */
+static ISurface* makeBigTexture(unsigned size, SurfaceLayout layout)
+{
+    static const unsigned SQUARE_SIZE = 4;
+    ISurface* texture = s_top->createSurface(PF_RGB_888, size, size, layout);
+
+    const Color colors[4] =
+    {
+        Color(255, 0, 0),
+        Color(0, 255, 0),
+        Color(0, 0, 255),
+        Color(255, 255, 0),
+    };
+
+    for (unsigned y = 0; y < size; y++)
+    {
+        for (unsigned x = 0; x < size; x += SQUARE_SIZE)
+            texture->fillSpan(x, y, SQUARE_SIZE, colors[(x / SQUARE_SIZE + y / SQUARE_SIZE) % 4]);
     }
 
     return texture;
@@ -269,6 +293,37 @@ static void drawSurface(ISurface* surface, unsigned frame)
             break;
         }
 
+        case TID_BIG_TEXTURE_LAYOUTS:
+        {
+            // Big enough that a rotated, shrunken texture misses the cache a lot
+            static const unsigned TEXTURE_SIZE = 2048;
+            static const double RADIUS = 0.45;
+            static const unsigned PERIMETER_COUNT = 36;
+            static const float FRAME_ANGLE_DELTA = 0.1f;
+            static ISurface* s_textures[2] =
+            {
+                makeBigTexture(TEXTURE_SIZE, SL_PACKED),
+                makeBigTexture(TEXTURE_SIZE, SL_TILED),
+            };
+
+            for (unsigned side = 0; side < 2; side++)
+            {
+                Vertex perimeter[PERIMETER_COUNT];
+                const float centerX = (side == 0 ? -0.5f : 0.5f);
+                Vertex center(centerX, 0.0f, 0.0f, VertexColor(1.0f, 1.0f, 1.0f), 0.5f, 0.5f);
+
+                setCircularVertexPattern(perimeter, PERIMETER_COUNT, RADIUS, 2.0f * M_PI / PERIMETER_COUNT, frame * FRAME_ANGLE_DELTA);
+                for (unsigned i = 0; i < PERIMETER_COUNT; i++)
+                    perimeter[i].x += centerX;
+
+                s_context->setTextureMap(s_textures[side]);
+                for (unsigned i = 0; i < PERIMETER_COUNT - 1; i++)
+                    s_context->triangle(surface, nullptr, perimeter + i, perimeter + i + 1, &center);
+                s_context->triangle(surface, nullptr, perimeter + PERIMETER_COUNT - 1, perimeter, &center);
+            }
+            break;
+        }
+
         case TID_BAD_PARAMETERS:
         {
             bool missedException = false, wrongException = false;
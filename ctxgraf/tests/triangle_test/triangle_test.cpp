@@ -6,6 +6,7 @@
 
 #include "viewer.h"
 #include "ctxgraf_pub.h"
+#include <vector>
 
 #define M_PI       3.14159265358979323846
 
@@ -37,6 +38,14 @@ enum TEST_ID
     TID_CLIPPING,
     TID_TRIANGLE_CIRCLE_ROTATING_WITH_Z,
     TID_DEGENERATES,
+    TID_TILED_BATCH,
+    TID_INDEXED_MESH,
+    TID_STRIP_AND_FAN,
+    TID_SUBPIXEL,
+    TID_VIEWPORT_AND_SCISSOR,
+    TID_CULLED_CUBE,
+    TID_SORT_LAST,
+    TID_BLENDING,
 
     TID_TEST_COUNT
 };
@@ -53,6 +62,14 @@ static const char* s_testStrings[TID_TEST_COUNT] =
     "Test x/y clipping",
     "Draw a many-sided polygon that rotates, with Z-buffering",
     "Draw some degenerate triangles (and one plain one)",
+    "Draw a many-sided polygon that rotates, with Z-buffering, as one tiled batch",
+    "Draw a rippling indexed grid mesh, with Z-buffering",
+    "Draw a rotating many-sided polygon as a fan and a wavy ribbon as a strip",
+    "Draw a slowly rotating many-sided polygon with subpixel precision, half of it as a tiled batch",
+    "Draw into a viewport and a moving scissor rectangle, including huge triangles that need clipping",
+    "Draw a spinning cube with back faces culled and no Z-buffering",
+    "Draw intersecting screen-sized triangles and a many-sided polygon, with Z-buffering, as one sort-last batch",
+    "Blend translucent triangles into an RGBA surface with Z-buffering and an alpha test, then over the screen",
 };
 
 
@@ -302,6 +319,370 @@ static void drawSurface(ISurface* surface, unsigned frame)
             break;
         }
 
+        case TID_TILED_BATCH:
+        {
+            // Same picture as TID_TRIANGLE_CIRCLE_ROTATING_WITH_Z, but submitted as a single batch
+            // and rendered tile by tile in parallel
+
+            static const double RADIUS = 0.45;
+            static const unsigned PERIMETER_COUNT = 36;
+            static const float FRAME_ANGLE_DELTA = 0.1f;
+
+            Vertex perimeter[PERIMETER_COUNT];
+            Vertex center(0.0f, 0.0f, 0.0f, VertexColor(1.0f, 1.0f, 1.0f));
+            double startAngle = frame * FRAME_ANGLE_DELTA;
+
+            setCircularVertexPattern(perimeter, PERIMETER_COUNT, RADIUS, 2.0f * M_PI / PERIMETER_COUNT, startAngle);
+            for (unsigned i = 0; i < PERIMETER_COUNT; i++)
+                perimeter[i].z = -0.2f;
+
+            Vertex batch[(PERIMETER_COUNT + 2) * 3];
+            for (unsigned i = 0; i < PERIMETER_COUNT; i++)
+            {
+                batch[3 * i + 0] = perimeter[i];
+                batch[3 * i + 1] = perimeter[(i + 1) % PERIMETER_COUNT];
+                batch[3 * i + 2] = center;
+            }
+
+            // Penetrating rectangle
+            Vertex v1(-0.15f, -0.55f, 0.2f, VertexColor(0.5f, 0.5f, 0.5f));
+            Vertex v2(0.15f, -0.55f, -0.3f, VertexColor(0.7f, 0.7f, 0.7f));
+            Vertex v3(0.15f, 0.55f, -0.3f, VertexColor(0.7f, 0.7f, 0.7f));
+            Vertex v4(-0.15f, 0.55f, 0.2f, VertexColor(0.5f, 0.5f, 0.5f));
+            Vertex* rectangle = batch + PERIMETER_COUNT * 3;
+            rectangle[0] = v1; rectangle[1] = v2; rectangle[2] = v3;
+            rectangle[3] = v3; rectangle[4] = v4; rectangle[5] = v1;
+
+            s_zBuffer->clear(0xFFFF);
+            s_context->setRenderMode(RENDER_MODE_TILED);
+            s_context->triangleList(surface, s_zBuffer, batch, PERIMETER_COUNT + 2);
+            s_context->setRenderMode(RENDER_MODE_IMMEDIATE);
+
+            break;
+        }
+
+        case TID_INDEXED_MESH:
+        {
+            // Draw a rippling indexed grid mesh, with Z-buffering
+
+            static const unsigned GRID_SIZE = 16;
+            static const float GRID_EXTENT = 0.8f;
+
+            Vertex vertices[(GRID_SIZE + 1) * (GRID_SIZE + 1)];
+            for (unsigned row = 0; row <= GRID_SIZE; row++)
+            {
+                for (unsigned col = 0; col <= GRID_SIZE; col++)
+                {
+                    Vertex& vertex = vertices[row * (GRID_SIZE + 1) + col];
+                    vertex.x = -GRID_EXTENT + 2.0f * GRID_EXTENT * col / GRID_SIZE;
+                    vertex.y = -GRID_EXTENT + 2.0f * GRID_EXTENT * row / GRID_SIZE;
+                    vertex.z = (float)(0.5 * sin(0.7 * col + 0.2 * frame) * cos(0.5 * row));
+                    vertex.color = VertexColor((float)col / GRID_SIZE, (vertex.z + 0.5f), (float)row / GRID_SIZE);
+                    vertex.color.clamp();
+                }
+            }
+
+            // Two triangles per grid cell; neighbouring cells share vertices
+            uint32_t indices[GRID_SIZE * GRID_SIZE * 6];
+            unsigned indexCount = 0;
+            for (unsigned row = 0; row < GRID_SIZE; row++)
+            {
+                for (unsigned col = 0; col < GRID_SIZE; col++)
+                {
+                    const uint32_t topLeft = row * (GRID_SIZE + 1) + col;
+                    const uint32_t bottomLeft = topLeft + GRID_SIZE + 1;
+                    indices[indexCount++] = topLeft;
+                    indices[indexCount++] = topLeft + 1;
+                    indices[indexCount++] = bottomLeft;
+                    indices[indexCount++] = topLeft + 1;
+                    indices[indexCount++] = bottomLeft + 1;
+                    indices[indexCount++] = bottomLeft;
+                }
+            }
+
+            s_zBuffer->clear(0xFFFF);
+            s_context->drawIndexed(surface, s_zBuffer, vertices, indices, indexCount);
+
+            break;
+        }
+
+        case TID_STRIP_AND_FAN:
+        {
+            // Draw a rotating many-sided polygon as a fan and a wavy ribbon as a strip
+
+            static const double RADIUS = 0.4;
+            static const unsigned PERIMETER_COUNT = 24;
+            static const float FRAME_ANGLE_DELTA = 0.1f;
+            static const unsigned RIBBON_SEGMENTS = 20;
+
+            // The fan's first vertex is the center, and its last one closes the circle
+            Vertex fan[PERIMETER_COUNT + 2];
+            fan[0] = Vertex(0.0f, 0.0f, 0.0f, VertexColor(1.0f, 1.0f, 1.0f));
+            setCircularVertexPattern(fan + 1, PERIMETER_COUNT, RADIUS, 2.0f * M_PI / PERIMETER_COUNT, frame * FRAME_ANGLE_DELTA);
+            fan[PERIMETER_COUNT + 1] = fan[1];
+            for (unsigned i = 0; i < PERIMETER_COUNT + 2; i++)
+                fan[i].x -= 0.45f;
+
+            s_context->triangleFan(surface, nullptr, fan, PERIMETER_COUNT + 2);
+
+            // The ribbon alternates between its top and bottom edges
+            Vertex ribbon[(RIBBON_SEGMENTS + 1) * 2];
+            for (unsigned i = 0; i <= RIBBON_SEGMENTS; i++)
+            {
+                const float x = 0.15f + 0.75f * i / RIBBON_SEGMENTS;
+                const float y = (float)(0.6 * sin(0.5 * i + 0.2 * frame));
+                const float t = (float)i / RIBBON_SEGMENTS;
+                ribbon[2 * i] = Vertex(x, y + 0.15f, 0.0f, VertexColor(1.0f - t, t, 0.0f));
+                ribbon[2 * i + 1] = Vertex(x, y - 0.15f, 0.0f, VertexColor(0.0f, 1.0f - t, t));
+            }
+
+            s_context->triangleStrip(surface, nullptr, ribbon, (RIBBON_SEGMENTS + 1) * 2);
+
+            break;
+        }
+
+        case TID_SUBPIXEL:
+        {
+            // Draw a slowly rotating many-sided polygon with subpixel precision; the second half
+            // of the fan goes through the tile renderer and must line up exactly with the first
+
+            static const double RADIUS = 0.6;
+            static const unsigned PERIMETER_COUNT = 24;
+            static const double FRAME_ANGLE_DELTA = 0.002;
+
+            Vertex fan[PERIMETER_COUNT + 2];
+            fan[0] = Vertex(0.0f, 0.0f, 0.0f, VertexColor(1.0f, 1.0f, 1.0f));
+            setCircularVertexPattern(fan + 1, PERIMETER_COUNT, RADIUS, 2.0f * M_PI / PERIMETER_COUNT, frame * FRAME_ANGLE_DELTA);
+            fan[PERIMETER_COUNT + 1] = fan[1];
+
+            s_context->setRasterMode(RASTER_MODE_SUBPIXEL);
+            s_context->triangleFan(surface, nullptr, fan, PERIMETER_COUNT / 2 + 1);
+
+            Vertex secondHalf[PERIMETER_COUNT / 2 + 3];
+            secondHalf[0] = fan[0];
+            for (unsigned i = 1; i < PERIMETER_COUNT / 2 + 3; i++)
+                secondHalf[i] = fan[PERIMETER_COUNT / 2 + i - 1];
+
+            s_context->setRenderMode(RENDER_MODE_TILED);
+            s_context->triangleFan(surface, nullptr, secondHalf, PERIMETER_COUNT / 2 + 3);
+            s_context->setRenderMode(RENDER_MODE_IMMEDIATE);
+
+            break;
+        }
+
+        case TID_VIEWPORT_AND_SCISSOR:
+        {
+            // Draw into a viewport and a moving scissor rectangle, including huge triangles that need clipping
+
+            static const double RADIUS = 0.9;
+            static const unsigned PERIMETER_COUNT = 24;
+
+            const unsigned width = surface->getWidth(), height = surface->getHeight();
+            const Rect viewport(width / 8, height / 8, width / 2, height / 2);
+            const Rect scissor((frame * 4) % width, height / 4, width / 3, height / 2);
+            s_context->setViewport(&viewport);
+            s_context->setScissor(&scissor);
+
+            // A triangle far bigger than the surface; only the part inside the viewport and scissor shows
+            Vertex v1(-40.0f, -30.0f, 0.0f, VertexColor(1.0f, 0.0f, 0.0f));
+            Vertex v2(60.0f, -25.0f, 0.0f, VertexColor(0.0f, 0.0f, 1.0f));
+            Vertex v3(5.0f, 70.0f, 0.0f, VertexColor(0.0f, 1.0f, 0.0f));
+            s_context->triangle(surface, nullptr, &v1, &v2, &v3);
+
+            Vertex fan[PERIMETER_COUNT + 2];
+            fan[0] = Vertex(0.0f, 0.0f, 0.0f, VertexColor(1.0f, 1.0f, 1.0f));
+            setCircularVertexPattern(fan + 1, PERIMETER_COUNT, RADIUS, 2.0f * M_PI / PERIMETER_COUNT);
+            fan[PERIMETER_COUNT + 1] = fan[1];
+            s_context->triangleFan(surface, nullptr, fan, PERIMETER_COUNT + 2);
+
+            s_context->setViewport(nullptr);
+            s_context->setScissor(nullptr);
+
+            break;
+        }
+
+        case TID_CULLED_CUBE:
+        {
+            // Draw a spinning cube with back faces culled and no Z-buffering; a closed convex mesh
+            // draws correctly in any order as long as the faces turned away are dropped
+
+            static const float HALF_SIZE = 0.4f;
+            static const float FRAME_ANGLE_DELTA = 0.03f;
+
+            // Corner i is at -/+ HALF_SIZE in x, y and z according to bits 0, 1 and 2 of i
+            const float yaw = frame * FRAME_ANGLE_DELTA, pitch = 0.5f + frame * FRAME_ANGLE_DELTA * 0.7f;
+            Vertex corners[8];
+            for (unsigned i = 0; i < 8; i++)
+            {
+                const float x = (i & 1) ? HALF_SIZE : -HALF_SIZE;
+                const float y = (i & 2) ? HALF_SIZE : -HALF_SIZE;
+                const float z = (i & 4) ? HALF_SIZE : -HALF_SIZE;
+
+                const float x1 = x * cosf(yaw) + z * sinf(yaw), z1 = -x * sinf(yaw) + z * cosf(yaw);
+                corners[i].x = x1;
+                corners[i].y = y * cosf(pitch) - z1 * sinf(pitch);
+                corners[i].z = y * sinf(pitch) + z1 * cosf(pitch);
+                corners[i].color = VertexColor((i & 1) ? 1.0f : 0.2f, (i & 2) ? 1.0f : 0.2f, (i & 4) ? 1.0f : 0.2f);
+            }
+
+            // Two triangles per face, counter-clockwise as seen from outside the cube
+            // (smaller z is nearer, so the viewer looks along +z)
+            static const uint32_t indices[36] =
+            {
+                0, 1, 3,  0, 3, 2,   // z = -HALF_SIZE
+                4, 6, 7,  4, 7, 5,   // z = +HALF_SIZE
+                0, 2, 6,  0, 6, 4,   // x = -HALF_SIZE
+                1, 5, 7,  1, 7, 3,   // x = +HALF_SIZE
+                0, 4, 5,  0, 5, 1,   // y = -HALF_SIZE
+                2, 3, 7,  2, 7, 6,   // y = +HALF_SIZE
+            };
+
+            s_context->setCullMode(CULL_BACK);
+            s_context->drawIndexed(surface, nullptr, corners, indices, 36);
+            s_context->setCullMode(CULL_NONE);
+
+            break;
+        }
+
+        case TID_SORT_LAST:
+        {
+            // A few triangles that each cover most of the screen, tilted so that they cut through
+            // each other, with a rotating many-sided polygon in front of them. The batch is split
+            // between threads, and their private images are merged by depth.
+
+            static const unsigned SHEET_COUNT = 4;
+            static const double RADIUS = 0.35;
+            static const unsigned PERIMETER_COUNT = 36;
+            static const float FRAME_ANGLE_DELTA = 0.05f;
+
+            Vertex batch[(SHEET_COUNT + PERIMETER_COUNT) * 3];
+
+            // Sheet i points its first corner 90 degrees further around than sheet i - 1,
+            // and is nearest at that corner
+            for (unsigned i = 0; i < SHEET_COUNT; i++)
+            {
+                const double angle = frame * FRAME_ANGLE_DELTA + i * M_PI / 2;
+                const VertexColor color(i == 0 || i == 3 ? 0.9f : 0.2f, i == 1 || i == 3 ? 0.8f : 0.2f, i == 2 ? 0.9f : 0.3f);
+                for (unsigned j = 0; j < 3; j++)
+                {
+                    const double cornerAngle = angle + j * 2.0 * M_PI / 3;
+                    batch[3 * i + j] = Vertex((float)(cos(cornerAngle) * 2.0), (float)(sin(cornerAngle) * 2.0), j == 0 ? -0.8f : 0.6f, color);
+                }
+            }
+
+            Vertex perimeter[PERIMETER_COUNT];
+            Vertex center(0.0f, 0.0f, -0.9f, VertexColor(1.0f, 1.0f, 1.0f));
+            setCircularVertexPattern(perimeter, PERIMETER_COUNT, RADIUS, 2.0f * M_PI / PERIMETER_COUNT, -frame * FRAME_ANGLE_DELTA);
+            for (unsigned i = 0; i < PERIMETER_COUNT; i++)
+                perimeter[i].z = (i % 2) ? -0.9f : 0.2f;
+
+            Vertex* fan = batch + SHEET_COUNT * 3;
+            for (unsigned i = 0; i < PERIMETER_COUNT; i++)
+            {
+                fan[3 * i + 0] = perimeter[i];
+                fan[3 * i + 1] = perimeter[(i + 1) % PERIMETER_COUNT];
+                fan[3 * i + 2] = center;
+            }
+
+            s_zBuffer->clear(0xFFFF);
+            s_context->setRenderMode(RENDER_MODE_SORT_LAST);
+            s_context->triangleList(surface, s_zBuffer, batch, SHEET_COUNT + PERIMETER_COUNT);
+            s_context->setRenderMode(RENDER_MODE_IMMEDIATE);
+
+            break;
+        }
+
+        case TID_BLENDING:
+        {
+            // Drawn into an RGBA surface, which is then copied to the screen: an opaque rotating
+            // polygon at the back, three translucent triangles blended source over on the left and
+            // additively on the right, a triangle fading to transparent that the alpha test cuts in
+            // half, and an opaque bar in front that hides what is behind it through the Z buffer.
+            // Last, a translucent sort-last batch (which is drawn tiled) goes straight over the
+            // screen surface, which has no alpha, with subpixel precision.
+
+            static const double RADIUS = 0.8;
+            static const unsigned PERIMETER_COUNT = 24;
+            static const double FRAME_ANGLE_DELTA = 0.02;
+
+            static ISurface* rgbaSurface = nullptr;
+            if (!rgbaSurface)
+                rgbaSurface = getTop()->createSurface(PF_RGBA_8888, IMAGE_WIDTH, IMAGE_HEIGHT);
+            rgbaSurface->clear(Color(15, 15, 63));
+            s_zBuffer->clear(0xFFFF);
+
+            Vertex fan[PERIMETER_COUNT + 2];
+            fan[0] = Vertex(0.0f, 0.0f, 0.6f, VertexColor(0.9f, 0.9f, 0.9f));
+            setCircularVertexPattern(fan + 1, PERIMETER_COUNT, RADIUS, 2.0f * M_PI / PERIMETER_COUNT, frame * FRAME_ANGLE_DELTA);
+            fan[PERIMETER_COUNT + 1] = fan[1];
+            for (unsigned i = 1; i < PERIMETER_COUNT + 2; i++)
+                fan[i].z = 0.6f;
+            s_context->triangleFan(rgbaSurface, s_zBuffer, fan, PERIMETER_COUNT + 2);
+
+            const Vertex bar[4] =
+            {
+                Vertex(-0.9f, -0.05f, -0.5f, VertexColor(0.3f, 0.3f, 0.3f)),
+                Vertex( 0.9f, -0.05f, -0.5f, VertexColor(0.3f, 0.3f, 0.3f)),
+                Vertex(-0.9f,  0.05f, -0.5f, VertexColor(0.3f, 0.3f, 0.3f)),
+                Vertex( 0.9f,  0.05f, -0.5f, VertexColor(0.3f, 0.3f, 0.3f)),
+            };
+            s_context->triangleStrip(rgbaSurface, s_zBuffer, bar, 4);
+
+            // Three triangles around (centerX, 0.2), each one a primary color at the given alpha
+            auto drawPrimaries = [&](float centerX, float alpha)
+            {
+                Vertex triangles[9];
+                for (unsigned i = 0; i < 3; i++)
+                {
+                    VertexColor color(i == 0 ? 1.0f : 0.0f, i == 1 ? 1.0f : 0.0f, i == 2 ? 1.0f : 0.0f);
+                    color.alpha = alpha;
+                    const double angle = i * 2.0 * M_PI / 3 + M_PI / 2;
+                    const float x = centerX + (float)(cos(angle) * 0.12), y = 0.2f + (float)(sin(angle) * 0.12);
+                    triangles[3 * i + 0] = Vertex(x - 0.25f, y - 0.2f, 0.0f, color);
+                    triangles[3 * i + 1] = Vertex(x + 0.25f, y - 0.2f, 0.0f, color);
+                    triangles[3 * i + 2] = Vertex(x, y + 0.25f, 0.0f, color);
+                }
+                s_context->triangleList(rgbaSurface, s_zBuffer, triangles, 3);
+            };
+
+            s_context->setBlendFunction(BLEND_FUNCTION_SOURCE_OVER);
+            drawPrimaries(-0.45f, 0.5f);
+            s_context->setBlendFunction(BLEND_FUNCTION_ADDITIVE);
+            drawPrimaries(0.45f, 0.7f);
+
+            VertexColor opaque(1.0f, 0.8f, 0.2f), transparent(1.0f, 0.8f, 0.2f);
+            transparent.alpha = 0.0f;
+            const Vertex faded1(-0.3f, -0.8f, 0.0f, transparent), faded2(0.3f, -0.8f, 0.0f, opaque), faded3(0.0f, -0.2f, 0.0f, opaque);
+            s_context->setBlendFunction(BLEND_FUNCTION_SOURCE_OVER);
+            s_context->setAlphaTestThreshold(128);
+            s_context->triangle(rgbaSurface, s_zBuffer, &faded1, &faded2, &faded3);
+            s_context->setAlphaTestThreshold(0);
+
+            std::vector<Color> row(IMAGE_WIDTH);
+            for (unsigned y = 0; y < IMAGE_HEIGHT; y++)
+            {
+                rgbaSurface->readSpan(0, y, IMAGE_WIDTH, row.data());
+                surface->drawSpan(0, y, IMAGE_WIDTH, row.data());
+            }
+
+            VertexColor white(1.0f, 1.0f, 1.0f);
+            white.alpha = 0.4f;
+            const float sweep = (float)sin(frame * FRAME_ANGLE_DELTA) * 0.5f;
+            const Vertex sheet[6] =
+            {
+                Vertex(sweep - 0.3f, -0.95f, -0.9f, white), Vertex(sweep + 0.3f, -0.95f, -0.9f, white), Vertex(sweep, 0.95f, -0.9f, white),
+                Vertex(-0.95f, 0.6f, -0.9f, white), Vertex(0.95f, 0.6f, -0.9f, white), Vertex(0.0f, 0.75f, -0.9f, white),
+            };
+            s_context->setRasterMode(RASTER_MODE_SUBPIXEL);
+            s_context->setRenderMode(RENDER_MODE_SORT_LAST);
+            s_context->triangleList(surface, s_zBuffer, sheet, 2);
+            s_context->setRenderMode(RENDER_MODE_IMMEDIATE);
+            s_context->setRasterMode(RASTER_MODE_PIXEL);
+            s_context->setBlendFunction(BLEND_FUNCTION_NONE);
+
+            break;
+        }
+
         default:
             fprintf(stderr, "Unknown test id: %d\n", s_testNumber);
             getchar();
@@ -3,6 +3,8 @@
 #include "glew.h"
 #include "wglew.h"
 #include "freeglut.h"
+#include <string.h>
+#include <vector>
 
 
 namespace ctxgraf
@@ -13,6 +15,7 @@ static const unsigned MIN_HEIGHT = 16;
 
 static Viewer* s_currentViewer = NULL;
 static GLuint s_textureName = 0;
+static std::vector<uint8_t> s_packedImage;
 
 
 static void initTexture()
@@ -42,8 +45,25 @@ static void loadTexture()
 {
     ISurface* image = s_currentViewer->getSurface();
 
+    // Rows may be padded out past the last pixel, so tell GL how far apart they
+    // really are, or pack them first if that isn't a whole number of pixels
+    const uint32_t rowBytes = image->getWidth() * 3;
+    const void* pixels = image->getStart();
+    if (image->getPitch() % 3 == 0)
+    {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, image->getPitch() / 3);
+    }
+    else
+    {
+        s_packedImage.resize(rowBytes * image->getHeight());
+        for (uint32_t y = 0; y < image->getHeight(); y++)
+            memcpy(&s_packedImage[y * rowBytes], static_cast<const uint8_t*>(pixels) + y * image->getPitch(), rowBytes);
+        pixels = &s_packedImage[0];
+    }
+
     // Reload the current texture with the new surface data
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image->getWidth(), image->getHeight(), 0, GL_RGB, GL_UNSIGNED_BYTE, image->getStart());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image->getWidth(), image->getHeight(), 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 }
 
 static void display()
@@ -30,13 +30,12 @@ static void drawTexture(ctxgraf::ISurface* surface, unsigned frame)
     for (int i = 0; i < IMAGE_HEIGHT; i++)
         surface->drawPixel(i, i, lineColor);
 
+    ctxgraf::Color row[100];
     for (unsigned y = 100; y < 200; y++)
     {
         for (unsigned x = 100; x < 200; x++)
-        {
-            ctxgraf::Color color((x+y+frame)%255, (y<=150)?255:63, ((x+frame)%300<=150)?255:127);
-            surface->drawPixel(x, y, color);
-        }
+            row[x - 100] = ctxgraf::Color((x+y+frame)%255, (y<=150)?255:63, ((x+frame)%300<=150)?255:127);
+        surface->drawSpan(100, y, 100, row);
     }
 }
 
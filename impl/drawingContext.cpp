@@ -1,10 +1,125 @@
 #include "drawingContext.h"
+#include "surface.h"
+#include "workerPool.h"
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <vector>
 
 namespace ctxgraf {
+
+	//the Surface behind a drawing surface or Z buffer if its rows can be written straight into memory, otherwise null
+	template <class SurfaceInterface>
+	static Surface* rowOrderSurface(SurfaceInterface* surface) {
+		Surface* result = dynamic_cast<Surface*>(surface);
+		return (result != nullptr && result->getLayout() != SL_TILED ? result : nullptr);
+	}
+
+	//true if a Z buffer has a value for every pixel of the drawing surface, so that their rows can be walked together
+	static bool coversSurface(const Surface* zSurface, const ISurface* drawingSurface) {
+		return zSurface->getWidth() >= drawingSurface->getWidth() && zSurface->getHeight() >= drawingSurface->getHeight();
+	}
+
+	//a pixel written straight into surface memory; alpha only goes into surfaces that have room for it
+	static inline void storeColor(uint8_t* loc, uint32_t colorBytes, const Color& color) {
+		loc[0] = color.red; loc[1] = color.green; loc[2] = color.blue;
+		if (colorBytes == 4) { loc[3] = color.alpha; }
+	}
+
+	//x / 255, rounded to nearest, for any x up to 255 * 255
+	static inline uint32_t divideBy255(uint32_t x) {
+		x += 128;
+		return (x + (x >> 8)) >> 8;
+	}
+
+	//one pixel of the blend functions. Color channels are weighted by the source alpha; alpha itself is
+	//weighted by 1, so that source over ends up with a_src + a_dst * (1 - a_src).
+	template <BlendFunction FUNCTION>
+	static inline void blendPixel(const Color& src, uint8_t* dst) {
+		const uint32_t source[4] = { src.red, src.green, src.blue, src.alpha };
+		const uint32_t weight[4] = { src.alpha, src.alpha, src.alpha, 255 };
+		for (int i = 0; i < 4; i++) {
+			switch (FUNCTION) {
+			case BLEND_FUNCTION_SOURCE_OVER:
+				dst[i] = (uint8_t)divideBy255(source[i] * weight[i] + dst[i] * (255 - src.alpha));
+				break;
+			case BLEND_FUNCTION_ADDITIVE:
+				dst[i] = (uint8_t)std::min<uint32_t>(dst[i] + divideBy255(source[i] * weight[i]), 255);
+				break;
+			case BLEND_FUNCTION_NONE:
+			default:
+				dst[i] = (uint8_t)source[i];
+			}
+		}
+	}
+
+	//blends a span of covered source pixels into count RGBA pixels (Color and PF_RGBA_8888 have the same layout)
+	template <BlendFunction FUNCTION>
+	static void blendSpan(const Color* src, const uint8_t* covered, uint8_t* dst, int count) {
+		int i = 0;
+#ifdef CTXGRAF_SSE2
+		//4 pixels at a time, with every channel widened to 16 bits; s * a + d * (255 - a) is never more than 255 * 255
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i all255 = _mm_set1_epi16(255), round = _mm_set1_epi16(128);
+		const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+		auto divide = [&](__m128i x) { //divideBy255() on every lane
+			x = _mm_add_epi16(x, round);
+			return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+		};
+		auto blendHalf = [&](__m128i s, __m128i d) { //two pixels, 16 bits a channel
+			__m128i alpha = _mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3));
+			alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+			const __m128i weight = _mm_or_si128(_mm_andnot_si128(alphaLanes, alpha), _mm_and_si128(alphaLanes, all255));
+			if (FUNCTION == BLEND_FUNCTION_SOURCE_OVER)
+				return divide(_mm_add_epi16(_mm_mullo_epi16(s, weight), _mm_mullo_epi16(d, _mm_sub_epi16(all255, alpha))));
+			return divide(_mm_mullo_epi16(s, weight));
+		};
+
+		for (; i + 4 <= count; i += 4) {
+			uint32_t coverage;
+			memcpy(&coverage, covered + i, 4);
+			if (coverage == 0) { continue; }
+
+			const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + 4 * i));
+			__m128i blended = s;
+			if (FUNCTION != BLEND_FUNCTION_NONE) {
+				blended = _mm_packus_epi16(blendHalf(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero)),
+					blendHalf(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero)));
+				if (FUNCTION == BLEND_FUNCTION_ADDITIVE)
+					blended = _mm_adds_epu8(blended, d);
+			}
+
+			//every coverage byte spread over its pixel's 4 bytes
+			__m128i keep = _mm_cvtsi32_si128((int)coverage);
+			keep = _mm_unpacklo_epi8(keep, keep);
+			keep = _mm_unpacklo_epi16(keep, keep);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i), _mm_or_si128(_mm_and_si128(keep, blended), _mm_andnot_si128(keep, d)));
+		}
+#endif
+		for (; i < count; i++) {
+			if (covered[i])
+				blendPixel<FUNCTION>(src[i], dst + 4 * i);
+		}
+	}
 	
 	void DrawingContext::polyline(ISurface * drawingSurface, const Vertex * vertices, uint32_t vertexCount) const {
+		if (vertices == nullptr || vertexCount < 2)
+			throw ParameterException("NULL vertex array, or fewer than 2 vertices in polyline");
+
+		int clipMinX, clipMinY, clipMaxX, clipMaxY;
+		if (!getClipRect(drawingSurface, clipMinX, clipMinY, clipMaxX, clipMaxY))
+			return;
+		if (m_lineShadingMode == LINE_SHADING_MODE_CONSTANT && vertexCount / DECIMATION_VERTICES_PER_COLUMN > (uint32_t)(clipMaxX - clipMinX + 1)) {
+			std::vector<uint32_t> kept;
+			decimatePolyline(drawingSurface, vertices, vertexCount, kept);
+			for (size_t i = 0; i + 1 < kept.size(); i++)
+				drawLine(drawingSurface, vertices[kept[i]], vertices[kept[i + 1]]);
+			return;
+		}
+
 		Vertex vA; //creating variable vA of type Vertex
 		Vertex vB; //creating variable vB of type Vertex
 		for (int i = 0; i < vertexCount - 1; i++)
@@ -13,269 +128,1605 @@ namespace ctxgraf {
 
 	}
 
-	void DrawingContext::drawLine(ISurface * drawingSurface, Vertex vA, Vertex vB) const {
-		//rasterization and interpolation stuff here
-
-		vA.x = (int)((drawingSurface->getWidth() - 1) * ((vA.x + 1.0) / 2.0)); vA.y = (int)((drawingSurface->getWidth() - 1) * ((vA.y + 1.0) / 2.0)); //All this does is connect lines together. Vertice to vertice
-		vB.x = (int)((drawingSurface->getWidth() - 1) * ((vB.x + 1.0) / 2.0)); vB.y = (int)((drawingSurface->getWidth() - 1) * ((vB.y + 1.0) / 2.0));
-
-		Vertex stepVertex; //creating stepVertex of type Vertex
-		Vertex lastPosition; //creating lastPostion of type Vertex
-		Vertex currentPosition; //creating currentPostion of type Vertex.
-		float dX = vA.x - vB.x; //difference between the vertices in x
-		float dY = vA.y - vB.y; //difference between vertices in y
-		float majorStart; //start of major axis
-		float minorStart; //start of minor axis
-		float majorEnd; //end of major axis
-		float minorEnd; //end of minor axis
-		float minorSlope; // minor slope
-		float majorDirection; //direction of the loop
-		float lastValue; //creating lastValue of type float
-		float currentValue; //creating currentValue of type float
-		bool drawPixel; //creating drawPixel of type bool
-
-		if (fabs(dX) > fabs(dY)) {
-			/*this will determine which axis is the major axis
-			if the major axis = x */
-			majorStart = vA.x; /*vertex A.x assigned to majorStart*/ majorEnd = vB.x; //vertex B.x assigned to major end.
-			minorStart = vA.y; /*vertex A.y assigned to minor start. */ minorEnd = vB.y; //vertex B.y assigned to minor end.
-			minorSlope = (minorEnd - minorStart) / (majorEnd - majorStart); /*this will determine the minor slope.
-																			this is the same thing as (y2-y1)/(x2-x1). This is how to determine the slope between two points.	*/
-			(dX >= 0) ? (majorDirection = -1) : (majorDirection = 1);
-			//if  difference in x is greater than zero then majorDirection equals -1.
-			//else major direction equals 1
-
-		}
-		else if (fabs(dX) <= fabs(dY)) { //if the major axis = y
-			majorStart = vA.y; /*vertex A.y is assigned to major start*/ majorEnd = vB.y; //vertex B.y is asssigned to major end
-			minorStart = vA.x; /*vertex A.x is assigned to minor start */ minorEnd = vB.x; //vertex B.x is assigned to minor end.
-			minorSlope = (minorEnd - minorStart) / (majorEnd - majorStart);
-			/*this will determine the minor slope.
-			this is the same thing as (y2-y1)/(x2-x1). This is how to determine the slope between two points.	*/
-			(dY > 0) ? (majorDirection = -1) : (majorDirection = 1);
-			//if  difference in x is greater than zero then majorDirection equals -1.
-			//else major direction equals 1
-
-		}
-
-		stepVertex.x = majorStart; stepVertex.y = minorStart; //setting stepvertex for x and y as the major start and minor start.
-
-		VertexColor currentColor = vA.color; //sets currentColor = to vA.color
-		VertexColor colorSlope; //creates variable colorSlope of type VertexColor
-
-		colorSlope.red = (vB.color.red - vA.color.red) / (majorEnd - majorStart);
-		colorSlope.green = (vB.color.green - vA.color.green) / (majorEnd - majorStart);
-		colorSlope.blue = (vB.color.blue - vA.color.blue) / (majorEnd - majorStart);
-
-		for (int i = majorStart - majorDirection; i != majorEnd - majorDirection; i += majorDirection) {
-			Vertex pixel; //creating pixel of type Vertex.
-			bool pixelDrawn = false; //sets pixelDrawn = false
-			for (int j = 0; j < 10; j++) { //b will iterate from 0 through 10
-				lastPosition.x = stepVertex.x - floor(stepVertex.x) - .5; /*the purpose of these two lines is to
-																		  set the last relative pos before the current step.*/
-				lastPosition.y = stepVertex.y - floor(stepVertex.y) - .5; //floor method rounds down
-
-				lastValue = fabs(lastPosition.x) + fabs(lastPosition.y);
-
-				stepVertex.x += .1 * majorDirection; stepVertex.y += minorSlope / 10.0 * majorDirection;
-
-				currentPosition.x = stepVertex.x - floor(stepVertex.x) - .5; currentPosition.y = stepVertex.y - floor(stepVertex.y) - .5;
-
-				currentValue = fabs(currentPosition.x) + fabs(currentPosition.y);
-
-				lastValue = floor((lastValue * 100)) / 100;
-				currentValue = floor((currentValue * 100)) / 100;
-
-				if ((currentValue >= .5 || (currentValue == .5 && currentPosition.y > 0)) && (lastValue <= .5 || (lastValue == .5 && lastPosition.y < 0))) {
-					pixel.x = stepVertex.x - (.1 * majorDirection); pixel.y = stepVertex.y - (minorSlope / 10.0 * majorDirection);
-					pixelDrawn = true;
-				}
+	void DrawingContext::polylines(ISurface * drawingSurface, const Vertex * vertices, const uint32_t * offsets, uint32_t polylineCount) const {
+		if (drawingSurface == nullptr || vertices == nullptr || offsets == nullptr)
+			throw ParameterException("NULL surface, vertex array or offset array in polylines");
+		for (uint32_t i = 0; i < polylineCount; i++) {
+			if (offsets[i + 1] < offsets[i])
+				throw ParameterException("decreasing offsets in polylines");
+		}
 
+		int clipMinX, clipMinY, clipMaxX, clipMaxY;
+		if (!getClipRect(drawingSurface, clipMinX, clipMinY, clipMaxX, clipMaxY))
+			return;
+
+		//every segment of every polyline, in drawing order, set up once (long constant-color polylines are decimated like in polyline())
+		std::vector<LineSetup> lines;
+		lines.reserve(offsets[polylineCount] - offsets[0]);
+		std::vector<uint32_t> kept;
+		for (uint32_t i = 0; i < polylineCount; i++) {
+			const uint32_t vertexCount = offsets[i + 1] - offsets[i];
+			if (m_lineShadingMode == LINE_SHADING_MODE_CONSTANT && vertexCount / DECIMATION_VERTICES_PER_COLUMN > (uint32_t)(clipMaxX - clipMinX + 1)) {
+				kept.clear();
+				decimatePolyline(drawingSurface, vertices + offsets[i], vertexCount, kept);
+				for (size_t k = 0; k + 1 < kept.size(); k++) {
+					lines.emplace_back();
+					setupLine(drawingSurface, vertices[offsets[i] + kept[k]], vertices[offsets[i] + kept[k + 1]], lines.back());
+				}
+				continue;
 			}
+			for (uint32_t v = offsets[i]; v + 1 < offsets[i + 1]; v++) {
+				lines.emplace_back();
+				setupLine(drawingSurface, vertices[v], vertices[v + 1], lines.back());
+			}
+		}
+
+		WorkerPool& pool = WorkerPool::instance();
+		if (pool.getThreadCount() == 1) {
+			for (const LineSetup& line : lines)
+				rasterizeLine(drawingSurface, line, clipMinX, clipMinY, clipMaxX, clipMaxY);
+			return;
+		}
+
+		//binning: every band of RENDER_TILE_SIZE rows gets the segments that can touch it, in order. A segment
+		//only touches rows between its endpoints' rows.
+		const int firstBand = clipMinY / RENDER_TILE_SIZE, lastBand = clipMaxY / RENDER_TILE_SIZE;
+		std::vector<std::vector<uint32_t>> bins(lastBand - firstBand + 1);
+		for (uint32_t i = 0; i < (uint32_t)lines.size(); i++) {
+			const int64_t minY = std::max<int64_t>(std::min(lines[i].YA, lines[i].YB) >> 4, clipMinY);
+			const int64_t maxY = std::min<int64_t>(std::max(lines[i].YA, lines[i].YB) >> 4, clipMaxY);
+			for (int64_t band = minY / RENDER_TILE_SIZE; band <= maxY / RENDER_TILE_SIZE; band++)
+				bins[band - firstBand].push_back(i);
+		}
+
+		//each band only draws its own rows, and draws its segments in order, so threads never write the same
+		//pixel and every pixel ends up with the same segment on top as when drawing them one at a time
+		pool.parallelFor((uint32_t)bins.size(), [&](uint32_t bin) {
+			const int minY = std::max((firstBand + (int)bin) * RENDER_TILE_SIZE, clipMinY);
+			const int maxY = std::min((firstBand + (int)bin) * RENDER_TILE_SIZE + RENDER_TILE_SIZE - 1, clipMaxY);
+			for (uint32_t i : bins[bin])
+				rasterizeLine(drawingSurface, lines[i], clipMinX, minY, clipMaxX, maxY);
+		});
+	}
+
+	void DrawingContext::drawLine(ISurface * drawingSurface, Vertex vA, Vertex vB) const {
+		int clipMinX, clipMinY, clipMaxX, clipMaxY;
+		if (!getClipRect(drawingSurface, clipMinX, clipMinY, clipMaxX, clipMaxY))
+			return;
+
+		LineSetup setup;
+		setupLine(drawingSurface, vA, vB, setup);
+		rasterizeLine(drawingSurface, setup, clipMinX, clipMinY, clipMaxX, clipMaxY);
+	}
 
-			Color color; //creates variable color of type Color
+	int64_t DrawingContext::placeLineCoordinate(float value, int32_t origin, uint32_t size) const {
 
-			if (!(m_lineShadingMode == LINE_SHADING_MODE_SMOOTH)) {
-				color.red = m_lineColor.red * 255;
-				color.green = m_lineColor.green * 255;
-				color.blue = m_lineColor.blue * 255;
+		//28.4 fixed point, placed the same way as triangle vertices: on whole pixels, or on the
+		//nearest 1/16 pixel in RASTER_MODE_SUBPIXEL
+		const double position = origin + (size - 1) * ((value + 1.0) / 2.0);
+		return (m_rasterMode == RASTER_MODE_SUBPIXEL ? llround(position * 16) : 16 * (int64_t)(int)position);
+	}
+
+	void DrawingContext::setupLine(ISurface * drawingSurface, const Vertex & vA, const Vertex & vB, LineSetup & setup) const {
+		const Rect viewport = getViewportRect(drawingSurface);
+		setup.XA = placeLineCoordinate(vA.x, viewport.x, viewport.width); setup.YA = placeLineCoordinate(vA.y, viewport.y, viewport.height);
+		setup.XB = placeLineCoordinate(vB.x, viewport.x, viewport.width); setup.YB = placeLineCoordinate(vB.y, viewport.y, viewport.height);
+		setup.colorA = vA.color; setup.colorB = vB.color;
+	}
 
+	void DrawingContext::decimatePolyline(ISurface * drawingSurface, const Vertex * vertices, uint32_t vertexCount, std::vector<uint32_t>& kept) const {
+
+		//M4: every run of consecutive vertices in the same pixel column is cut down to its first, lowest, highest
+		//and last vertex, in their original order. Those reach the same rows of that column and leave it in the
+		//same place, so the line covers (nearly) the same pixels with at most 4 vertices per column.
+		const Rect viewport = getViewportRect(drawingSurface);
+		auto column = [&](uint32_t i) { return placeLineCoordinate(vertices[i].x, viewport.x, viewport.width) >> 4; };
+
+		uint32_t runStart = 0, lowest = 0, highest = 0;
+		int64_t runColumn = column(0);
+		for (uint32_t i = 1; i <= vertexCount; i++) {
+			const int64_t nextColumn = (i < vertexCount ? column(i) : runColumn + 1);
+			if (nextColumn == runColumn) {
+				if (vertices[i].y < vertices[lowest].y) { lowest = i; }
+				if (vertices[i].y > vertices[highest].y) { highest = i; }
+				continue;
 			}
-			else if (m_lineShadingMode == LINE_SHADING_MODE_SMOOTH) {
-				color.red = currentColor.red * 255;
-				currentColor.red += colorSlope.red * majorDirection;
 
-				color.green = currentColor.green * 255;
-				currentColor.green += colorSlope.green * majorDirection;
+			const uint32_t picks[4] = { runStart, std::min(lowest, highest), std::max(lowest, highest), i - 1 };
+			for (uint32_t pick : picks) {
+				if (kept.empty() || kept.back() != pick)
+					kept.push_back(pick);
+			}
+			runStart = lowest = highest = i;
+			runColumn = nextColumn;
+		}
+	}
+
+	void DrawingContext::rasterizeLine(ISurface * drawingSurface, const LineSetup & setup, int clipMinX, int clipMinY, int clipMaxX, int clipMaxY) const {
+
+		const int64_t XA = setup.XA, YA = setup.YA, XB = setup.XB, YB = setup.YB;
+
+		//trivial reject (both endpoints past the same side of the clip rectangle): every pixel a line touches is
+		//in the pixel range its endpoints span
+		if (std::max(XA, XB) < 16 * (int64_t)clipMinX || std::min(XA, XB) >= 16 * ((int64_t)clipMaxX + 1)
+			|| std::max(YA, YB) < 16 * (int64_t)clipMinY || std::min(YA, YB) >= 16 * ((int64_t)clipMaxY + 1))
+			return;
+
+		const bool xMajor = llabs(XB - XA) >= llabs(YB - YA);
+		const int64_t majorStart = (xMajor ? XA : YA), majorEnd = (xMajor ? XB : YB);
+		const int64_t minorStart = (xMajor ? YA : XA), minorEnd = (xMajor ? YB : XB);
+		if (majorStart == majorEnd)
+			return; //both endpoints are the same point
+
+		//one pixel per pixel center (16p + 8) along the major axis, from A up to but not including B, so that
+		//the pixel at a vertex shared by two polyline segments is only drawn once
+		const int direction = (majorEnd > majorStart ? 1 : -1);
+		const int64_t majorMin = (xMajor ? clipMinX : clipMinY), majorMax = (xMajor ? clipMaxX : clipMaxY);
+		const int64_t minorMin = (xMajor ? clipMinY : clipMinX), minorMax = (xMajor ? clipMaxY : clipMaxX);
+		const int64_t unclippedFirst = (direction > 0 ? (majorStart + 7) >> 4 : (majorStart - 8) >> 4);
+		int64_t first, last;
+		if (direction > 0) {
+			first = std::max<int64_t>(unclippedFirst, majorMin);
+			last = std::min<int64_t>(((majorEnd + 7) >> 4) - 1, majorMax);
+		}
+		else {
+			first = std::min<int64_t>(unclippedFirst, majorMax);
+			last = std::max<int64_t>(((majorEnd - 8) >> 4) + 1, majorMin);
+		}
+		if ((last - first) * direction < 0)
+			return; //no pixel centers between the endpoints, or all of them clipped away
+
+		//Bresenham: the minor axis pixel is floor(N / D), kept as a whole part and a remainder in [0, D) so that
+		//stepping never rounds. N / D is the minor position in 1/16 pixels over 16, and N changes by S per pixel.
+		const int64_t majorLength = llabs(majorEnd - majorStart), minorDelta = minorEnd - minorStart;
+		auto floorDivide = [](int64_t numerator, int64_t denominator) {
+			const int64_t quotient = numerator / denominator;
+			return (numerator % denominator < 0 ? quotient - 1 : quotient); //denominator is always positive
+		};
+		const int64_t D = 16 * majorLength, S = 16 * minorDelta;
+		auto numeratorAt = [&](int64_t p) { return minorStart * majorLength + (16 * p + 8 - majorStart) * direction * minorDelta; };
+
+		//Liang-Barsky on the minor axis: the pixels k steps past first stay inside while minorMin * D <= N < (minorMax + 1) * D.
+		//N is linear in k, so solving for k gives the visible part exactly, and only that part is walked.
+		{
+			const int64_t N0 = numeratorAt(first), lower = minorMin * D, upper = (minorMax + 1) * D;
+			int64_t kFirst = 0, kLast = (last - first) * direction;
+			if (S > 0) {
+				kFirst = std::max(kFirst, -floorDivide(N0 - lower, S)); //ceil((lower - N0) / S)
+				kLast = std::min(kLast, -floorDivide(N0 - upper, S) - 1);
+			}
+			else if (S < 0) {
+				kFirst = std::max(kFirst, floorDivide(N0 - upper, -S) + 1);
+				kLast = std::min(kLast, floorDivide(N0 - lower, -S));
+			}
+			else if (N0 < lower || N0 >= upper)
+				return;
+			if (kFirst > kLast)
+				return; //the line passes by the clip rectangle
+			last = first + kLast * direction;
+			first += kFirst * direction;
+		}
+
+		const int64_t N = numeratorAt(first);
+		int64_t minorPixel = floorDivide(N, D), remainder = N - minorPixel * D;
+		const int64_t minorPixelStep = floorDivide(S, D), remainderStep = S - minorPixelStep * D;
+
+		//smooth shading: 0-255 color channels in 16.16, stepped the same way. They start from the first pixel
+		//the whole segment has, so a pixel gets the same color however the segment was clipped.
+		const VertexColor& colorA = setup.colorA; const VertexColor& colorB = setup.colorB;
+		const int64_t skipped = (first - unclippedFirst) * direction;
+		auto channelStart = [&](float start, float end, int64_t& step) {
+			const double perUnit = (end - start) * 255 * 65536.0 / (majorEnd - majorStart);
+			step = llround(16 * direction * perUnit);
+			return llround(start * 255 * 65536.0 + (16 * unclippedFirst + 8 - majorStart) * perUnit) + skipped * step;
+		};
+		auto channel = [](int64_t value) { return (uint8_t)std::min<int64_t>(std::max<int64_t>(value >> 16, 0), 255); };
+		int64_t redStep, greenStep, blueStep, alphaStep;
+		int64_t red = channelStart(colorA.red, colorB.red, redStep);
+		int64_t green = channelStart(colorA.green, colorB.green, greenStep);
+		int64_t blue = channelStart(colorA.blue, colorB.blue, blueStep);
+		int64_t alpha = channelStart(colorA.alpha, colorB.alpha, alphaStep);
+
+		const bool smooth = (m_lineShadingMode == LINE_SHADING_MODE_SMOOTH);
+		const bool flat = (!smooth || (redStep == 0 && greenStep == 0 && blueStep == 0 && alphaStep == 0));
+		Color color;
+		if (!smooth) {
+			color.red = m_lineColor.red * 255;
+			color.green = m_lineColor.green * 255;
+			color.blue = m_lineColor.blue * 255;
+			color.alpha = m_lineColor.alpha * 255;
+		}
+		else if (flat) {
+			color.red = channel(red); color.green = channel(green); color.blue = channel(blue); color.alpha = channel(alpha);
+		}
 
-				color.blue = currentColor.blue * 255;
-				currentColor.blue += colorSlope.blue * majorDirection;
+		//write straight into surface memory when the layout is known, otherwise go through the interface
+		Surface* colorSurface = rowOrderSurface(drawingSurface);
+		uint8_t* colorStart = (colorSurface != nullptr ? static_cast<uint8_t*>(colorSurface->getStart()) : nullptr);
+		const int64_t colorPitch = (colorSurface != nullptr ? colorSurface->getPitch() : 0);
+		const uint32_t colorBytes = (colorSurface != nullptr && colorSurface->getFormat() == PF_RGBA_8888 ? 4 : 3);
+
+		//horizontal and vertical segments of one color are a single span of pixels
+		if (flat && S == 0 && colorStart != nullptr) {
+			const int64_t from = std::min(first, last), count = llabs(last - first) + 1;
+			uint8_t* loc = colorStart + (xMajor ? minorPixel * colorPitch + from * colorBytes : from * colorPitch + minorPixel * colorBytes);
+			if (xMajor && colorBytes == 3 && color.red == color.green && color.red == color.blue)
+				memset(loc, color.red, (size_t)(3 * count));
+			else {
+				const int64_t stride = (xMajor ? colorBytes : colorPitch);
+				for (int64_t i = 0; i < count; i++, loc += stride)
+					storeColor(loc, colorBytes, color);
 			}
+			return;
+		}
 
-			stepVertex.x = floor(stepVertex.x + .5);
+		for (int64_t p = first; ; p += direction) {
+			if (!flat) {
+				color.red = channel(red);
+				color.green = channel(green);
+				color.blue = channel(blue);
+				color.alpha = channel(alpha);
+				red += redStep; green += greenStep; blue += blueStep; alpha += alphaStep;
+			}
 
-			if (fabs(dX) > fabs(dY))
-				//x is major axis in this case
-				drawingSurface->drawPixel(floor(pixel.x), floor(pixel.y), color);
-			else if (fabs(dX) <= fabs(dY)) //y is major axis in this case
-				drawingSurface->drawPixel(floor(pixel.y), floor(pixel.x), color);
+			const int64_t x = (xMajor ? p : minorPixel), y = (xMajor ? minorPixel : p);
+			if (colorStart != nullptr)
+				storeColor(colorStart + y * colorPitch + x * colorBytes, colorBytes, color);
+			else
+				drawingSurface->drawPixel((uint32_t)x, (uint32_t)y, color);
+
+			if (p == last)
+				break;
+			minorPixel += minorPixelStep; remainder += remainderStep;
+			if (remainder >= D) { remainder -= D; minorPixel++; }
 		}
 	}
 
 	void DrawingContext::triangle(ISurface * drawingSurface, IZBuffer * zBuffer, const Vertex * v1, const Vertex * v2, const Vertex * v3) const {
 
-		//Here we are going to copy the pointer vertex objects to local vertex objects and convert them to surface coordinates.
+		TriangleSetup setups[MAX_CLIPPED_TRIANGLES];
+		const uint32_t preparedCount = prepareTriangle(drawingSurface, getGuardBand(drawingSurface), v1, v2, v3, setups);
+		const uint32_t setupCount = setupTransformedTriangles(drawingSurface, setups, preparedCount);
+
+		for (uint32_t i = 0; i < setupCount; i++) //none if degenerate, or nothing left to draw after snapping and clipping
+			rasterizeTriangle(drawingSurface, zBuffer, setups[i]);
+	}
+
+	void DrawingContext::triangleList(ISurface * drawingSurface, IZBuffer * zBuffer, const Vertex * vertices, uint32_t triangleCount) const {
+		if (drawingSurface == nullptr || vertices == nullptr)
+			throw ParameterException("NULL surface or vertex array in triangleList");
+
+		const GuardBand band = getGuardBand(drawingSurface);
+		drawBatch(drawingSurface, zBuffer, triangleCount, [&](uint32_t i, TriangleSetup* setups) {
+			return prepareTriangle(drawingSurface, band, vertices + 3 * i, vertices + 3 * i + 1, vertices + 3 * i + 2, setups);
+		});
+	}
+
+	void DrawingContext::drawIndexed(ISurface * drawingSurface, IZBuffer * zBuffer, const Vertex * vertices, const uint32_t * indices, uint32_t indexCount) const {
+		if (drawingSurface == nullptr || vertices == nullptr || indices == nullptr)
+			throw ParameterException("NULL surface, vertex array or index array in drawIndexed");
+
+		//post-transform cache: a vertex shared by nearby triangles is only converted to surface coordinates once.
+		//It is direct-mapped on the index, which suits meshes whose triangles reuse recent indices.
+		struct CachedVertex {
+			uint32_t index;
+			Vertex vertex;
+		} cache[VERTEX_CACHE_SIZE];
+		for (CachedVertex& entry : cache)
+			entry.index = UINT32_MAX;
+
+		auto fetch = [&](uint32_t index) -> const Vertex& {
+			CachedVertex& entry = cache[index % VERTEX_CACHE_SIZE];
+			if (entry.index != index) {
+				entry.index = index;
+				transformVertex(drawingSurface, vertices[index], entry.vertex);
+			}
+			return entry.vertex;
+		};
+
+		const GuardBand band = getGuardBand(drawingSurface);
+		drawBatch(drawingSurface, zBuffer, indexCount / 3, [&](uint32_t i, TriangleSetup* setups) -> uint32_t {
+			const Vertex* v1 = vertices + indices[3 * i]; const Vertex* v2 = vertices + indices[3 * i + 1]; const Vertex* v3 = vertices + indices[3 * i + 2];
+			if (!band.contains(*v1) || !band.contains(*v2) || !band.contains(*v3))
+				return prepareTriangle(drawingSurface, band, v1, v2, v3, setups); //needs clipping, which works on the original vertices
+			if (isCulled(v1, v2, v3))
+				return 0;
+
+			setups[0].v1 = fetch(indices[3 * i]); setups[0].v2 = fetch(indices[3 * i + 1]); setups[0].v3 = fetch(indices[3 * i + 2]);
+			return 1;
+		});
+	}
+
+	void DrawingContext::triangleStrip(ISurface * drawingSurface, IZBuffer * zBuffer, const Vertex * vertices, uint32_t vertexCount) const {
+		if (drawingSurface == nullptr || vertices == nullptr || vertexCount < 3)
+			throw ParameterException("NULL surface or vertex array, or fewer than 3 vertices in triangleStrip");
+
+		//every vertex is shared by up to three triangles, so convert each one just once (vertices outside the guard band go through clipping instead)
+		const GuardBand band = getGuardBand(drawingSurface);
+		std::vector<Vertex> transformed(vertexCount);
+		for (uint32_t i = 0; i < vertexCount; i++) {
+			if (band.contains(vertices[i]))
+				transformVertex(drawingSurface, vertices[i], transformed[i]);
+		}
+
+		drawBatch(drawingSurface, zBuffer, vertexCount - 2, [&](uint32_t i, TriangleSetup* setups) -> uint32_t {
+			//swap the first two vertices of every other triangle so that they all wind the same way
+			const uint32_t first = (i & 1) ? i + 1 : i, second = (i & 1) ? i : i + 1;
+			if (!band.contains(vertices[first]) || !band.contains(vertices[second]) || !band.contains(vertices[i + 2]))
+				return prepareTriangle(drawingSurface, band, vertices + first, vertices + second, vertices + i + 2, setups);
+			if (isCulled(vertices + first, vertices + second, vertices + i + 2))
+				return 0;
+
+			setups[0].v1 = transformed[first]; setups[0].v2 = transformed[second]; setups[0].v3 = transformed[i + 2];
+			return 1;
+		});
+	}
+
+	void DrawingContext::triangleFan(ISurface * drawingSurface, IZBuffer * zBuffer, const Vertex * vertices, uint32_t vertexCount) const {
+		if (drawingSurface == nullptr || vertices == nullptr || vertexCount < 3)
+			throw ParameterException("NULL surface or vertex array, or fewer than 3 vertices in triangleFan");
+
+		//the center is shared by every triangle and each rim vertex by two, so convert each one just once (vertices outside the guard band go through clipping instead)
+		const GuardBand band = getGuardBand(drawingSurface);
+		std::vector<Vertex> transformed(vertexCount);
+		for (uint32_t i = 0; i < vertexCount; i++) {
+			if (band.contains(vertices[i]))
+				transformVertex(drawingSurface, vertices[i], transformed[i]);
+		}
+
+		drawBatch(drawingSurface, zBuffer, vertexCount - 2, [&](uint32_t i, TriangleSetup* setups) -> uint32_t {
+			if (!band.contains(vertices[0]) || !band.contains(vertices[i + 1]) || !band.contains(vertices[i + 2]))
+				return prepareTriangle(drawingSurface, band, vertices, vertices + i + 1, vertices + i + 2, setups);
+			if (isCulled(vertices, vertices + i + 1, vertices + i + 2))
+				return 0;
+
+			setups[0].v1 = transformed[0]; setups[0].v2 = transformed[i + 1]; setups[0].v3 = transformed[i + 2];
+			return 1;
+		});
+	}
+
+	void DrawingContext::drawBatch(ISurface * drawingSurface, IZBuffer * zBuffer, uint32_t triangleCount, const std::function<uint32_t(uint32_t, TriangleSetup*)>& prepareTriangleAt) const {
+
+		const bool deferred = (m_renderMode != RENDER_MODE_IMMEDIATE);
+		std::vector<TriangleSetup> setups; //only collected when the whole batch is drawn at the end
+		if (deferred)
+			setups.reserve(triangleCount);
+
+		//transformed triangles are set up SETUP_BATCH_SIZE or so at a time, so that setup can work on several at once.
+		//Order is kept, so drawing them a little later than they were prepared doesn't change anything.
+		std::vector<TriangleSetup> prepared(SETUP_BATCH_SIZE + MAX_CLIPPED_TRIANGLES);
+		uint32_t preparedCount = 0;
+		auto setupPrepared = [&]() {
+			const uint32_t setupCount = setupTransformedTriangles(drawingSurface, prepared.data(), preparedCount);
+			for (uint32_t j = 0; j < setupCount; j++) {
+				if (deferred)
+					setups.push_back(prepared[j]);
+				else
+					rasterizeTriangle(drawingSurface, zBuffer, prepared[j]);
+			}
+			preparedCount = 0;
+		};
+
+		for (uint32_t i = 0; i < triangleCount; i++) {
+			preparedCount += prepareTriangleAt(i, prepared.data() + preparedCount);
+			if (preparedCount >= SETUP_BATCH_SIZE)
+				setupPrepared();
+		}
+		setupPrepared();
+
+		if (!deferred)
+			return;
+		//merging by depth would lose the order blending depends on; tiles keep it
+		if (m_renderMode == RENDER_MODE_SORT_LAST && zBuffer != nullptr && !m_pipeline.blended)
+			renderSortLast(drawingSurface, zBuffer, setups.data(), (uint32_t)setups.size());
+		else
+			renderTiled(drawingSurface, zBuffer, setups.data(), (uint32_t)setups.size());
+	}
+
+	void DrawingContext::renderTiled(ISurface * drawingSurface, IZBuffer * zBuffer, const TriangleSetup * setups, uint32_t setupCount) const {
+
+		const int tilesX = (drawingSurface->getWidth() + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+		const int tilesY = (drawingSurface->getHeight() + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
 
-		Vertex vertex1 = *v1; Vertex vertex2 = *v2; Vertex vertex3 = *v3;
+		//binning: every tile gets the list of triangles whose bounding box touches it, in submission order
+		std::vector<std::vector<uint32_t>> bins(tilesX * tilesY);
+		for (uint32_t i = 0; i < setupCount; i++) {
+			const TriangleSetup& setup = setups[i];
+			for (int ty = setup.minY / RENDER_TILE_SIZE; ty <= setup.maxY / RENDER_TILE_SIZE; ty++)
+				for (int tx = setup.minX / RENDER_TILE_SIZE; tx <= setup.maxX / RENDER_TILE_SIZE; tx++)
+					bins[ty * tilesX + tx].push_back(i);
+		}
+
+		//each tile only ever touches its own pixels (color and Z), so tiles can run in parallel without locks
+		WorkerPool::instance().parallelFor(tilesX * tilesY, [&](uint32_t tile) {
+			const std::vector<uint32_t>& bin = bins[tile];
+			if (bin.empty())
+				return;
+
+			const int minX = (tile % tilesX) * RENDER_TILE_SIZE, minY = (tile / tilesX) * RENDER_TILE_SIZE;
+			const int maxX = minX + RENDER_TILE_SIZE - 1, maxY = minY + RENDER_TILE_SIZE - 1;
+
+			TriangleSetup clipped;
+			for (uint32_t i : bin) {
+				if (clipSetup(setups[i], minX, minY, maxX, maxY, clipped))
+					rasterizeTriangle(drawingSurface, zBuffer, clipped);
+			}
+		});
+	}
 
-		//check for invalid triangles by checking if slopes are the same (This formula is derived from the slope
-		//formula between the three points) since floating point math is not perfect, we need a tiny margin of error
-		if (floor((vertex2.y - vertex1.y)*(vertex3.x - vertex2.x) * 100000) == floor((vertex3.y - vertex2.y)*(vertex2.x - vertex1.x) * 100000))
-			return; //all points lie on a line or on the same point, so do not draw.
+	void DrawingContext::renderSortLast(ISurface * drawingSurface, IZBuffer * zBuffer, const TriangleSetup * setups, uint32_t setupCount) const {
+
+		//one run of consecutive triangles per thread. Merging the runs by depth, with ties going to the earlier
+		//run (and to what was already there), gives exactly what drawing them one at a time would have.
+		WorkerPool& pool = WorkerPool::instance();
+		const uint32_t runCount = std::min(pool.getThreadCount(), setupCount);
+		if (runCount <= 1) {
+			for (uint32_t i = 0; i < setupCount; i++)
+				rasterizeTriangle(drawingSurface, zBuffer, setups[i]);
+			return;
+		}
+
+		//the targets are shared by every caller of this context, so one sort-last batch uses them at a time
+		std::lock_guard<std::mutex> lock(m_sortLastMutex);
+
+		//the private targets only have to be made again when the drawing surface changes shape
+		const uint32_t width = drawingSurface->getWidth(), height = drawingSurface->getHeight();
+		const PixelFormat format = drawingSurface->getFormat();
+		if (m_sortLastTargets.size() < runCount)
+			m_sortLastTargets.resize(runCount);
+		for (uint32_t run = 0; run < runCount; run++) {
+			SortLastTarget& target = m_sortLastTargets[run];
+			if (target.color == nullptr || target.color->getWidth() != width || target.color->getHeight() != height || target.color->getFormat() != format) {
+				//aligned rows let the clear of a new target finish each row with whole vector stores
+				target.color.reset(getTop()->createSurface(format, width, height, SL_ALIGNED));
+				target.zBuffer.reset(getTop()->createZBuffer(width, height, SL_ALIGNED));
+				target.zBuffer->clear(0xFFFF);
+				target.minX = width; target.maxX = -1; target.minY = height; target.maxY = -1;
+			}
+		}
 
-		vertex1.x = (int)((drawingSurface->getWidth() - 1) * ((vertex1.x + 1.0) / 2.0)); //basically finding where each vertex is in the triangle (endpoint to surface values).
-		vertex2.x = (int)((drawingSurface->getWidth() - 1) * ((vertex2.x + 1.0) / 2.0));
-		vertex3.x = (int)((drawingSurface->getWidth() - 1) * ((vertex3.x + 1.0) / 2.0));
-		vertex1.y = (int)((drawingSurface->getHeight() - 1) * ((vertex1.y + 1.0) / 2.0));
-		vertex2.y = (int)((drawingSurface->getHeight() - 1) * ((vertex2.y + 1.0) / 2.0));
-		vertex3.y = (int)((drawingSurface->getHeight() - 1) * ((vertex3.y + 1.0) / 2.0));
-		vertex1.z = (65535)*((vertex1.z + 1.0) / 2.0); //this is for z buffering
-		vertex2.z = (65535)*((vertex2.z + 1.0) / 2.0);
-		vertex3.z = (65535)*((vertex3.z + 1.0) / 2.0);
+		pool.parallelFor(runCount, [&](uint32_t run) {
+			SortLastTarget& target = m_sortLastTargets[run];
+			const uint32_t first = (uint32_t)((uint64_t)setupCount * run / runCount), last = (uint32_t)((uint64_t)setupCount * (run + 1) / runCount);
+
+			//only Z has to start out empty, and only the last batch's box can have been written since;
+			//color is never read where Z wasn't written
+			if (target.minX <= target.maxX) {
+				const std::vector<uint32_t> farZ(target.maxX - target.minX + 1, 0xFFFF);
+				for (int y = target.minY; y <= target.maxY; y++)
+					target.zBuffer->setZSpan(target.minX, y, (uint32_t)farZ.size(), farZ.data());
+			}
+			target.minX = width; target.maxX = -1; target.minY = height; target.maxY = -1;
+			for (uint32_t i = first; i < last; i++) {
+				const TriangleSetup& setup = setups[i];
+				target.minX = std::min(target.minX, setup.minX); target.maxX = std::max(target.maxX, setup.maxX);
+				target.minY = std::min(target.minY, setup.minY); target.maxY = std::max(target.maxY, setup.maxY);
+				rasterizeTriangle(target.color.get(), target.zBuffer.get(), setup);
+			}
+		});
+
+		//merge in bands of rows; runs are merged in order within a band, and bands never share a pixel
+		const uint32_t bandCount = (height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+		pool.parallelFor(bandCount, [&](uint32_t band) {
+			const int minY = band * RENDER_TILE_SIZE, maxY = std::min(minY + RENDER_TILE_SIZE - 1, (int)height - 1);
+			for (uint32_t run = 0; run < runCount; run++) {
+				const SortLastTarget& target = m_sortLastTargets[run];
+				compositeByDepth(drawingSurface, zBuffer, target, std::max(minY, target.minY), std::min(maxY, target.maxY));
+			}
+		});
+	}
+
+	void DrawingContext::compositeByDepth(ISurface * drawingSurface, IZBuffer * zBuffer, const SortLastTarget & target, int minY, int maxY) const {
+
+		if (minY > maxY || target.minX > target.maxX)
+			return;
+
+		//the private targets always come from Top, so their memory layout is known
+		const Surface* colorSource = static_cast<const Surface*>(target.color.get());
+		const Surface* zSource = static_cast<const Surface*>(target.zBuffer.get());
+
+		//rows of memory are only merged when the caller's Z buffer is as large as the targets, which match the color surface
+		Surface* colorSurface = rowOrderSurface(drawingSurface);
+		Surface* zSurface = rowOrderSurface(zBuffer);
+		if (colorSurface == nullptr || zSurface == nullptr || zSurface->getFormat() != PF_Z16 || !coversSurface(zSurface, colorSurface)) {
+			for (int y = minY; y <= maxY; y++) {
+				for (int x = target.minX; x <= target.maxX; x++) {
+					const uint32_t Z = zSource->getZ(x, y);
+					if (Z < zBuffer->getZ(x, y)) {
+						zBuffer->setZ(x, y, Z);
+						drawingSurface->drawPixel(x, y, colorSource->getPixel(x, y));
+					}
+				}
+			}
+			return;
+		}
+
+		const uint32_t colorBytes = (colorSurface->getFormat() == PF_RGBA_8888 ? 4 : 3);
+		const bool hiZ = zSurface->hasHiZ();
+
+		for (int y = minY; y <= maxY; y++) {
+			const uint16_t* srcZ = reinterpret_cast<const uint16_t*>(static_cast<const uint8_t*>(zSource->getStart()) + y * zSource->getPitch());
+			uint16_t* dstZ = reinterpret_cast<uint16_t*>(static_cast<uint8_t*>(zSurface->getStart()) + y * zSurface->getPitch());
+			const uint8_t* srcColor = static_cast<const uint8_t*>(colorSource->getStart()) + y * colorSource->getPitch();
+			uint8_t* dstColor = static_cast<uint8_t*>(colorSurface->getStart()) + y * colorSurface->getPitch();
+
+			int x = target.minX;
+#ifdef CTXGRAF_SSE2
+			//8 pixels at a time: a masked Z merge, then color for just the pixels that won
+			const __m128i zBias16 = _mm_set1_epi16((short)0x8000); //unsigned compare by way of the signed one
+			for (; x + 7 <= target.maxX; x += 8) {
+				const __m128i src = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcZ + x));
+				const __m128i dst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dstZ + x));
+				const __m128i nearer = _mm_cmplt_epi16(_mm_xor_si128(src, zBias16), _mm_xor_si128(dst, zBias16));
+				const int mask = _mm_movemask_epi8(nearer);
+				if (mask == 0) { continue; }
+
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dstZ + x), _mm_or_si128(_mm_and_si128(nearer, src), _mm_andnot_si128(nearer, dst)));
+				if (hiZ) { zSurface->markZWritten(x, y); zSurface->markZWritten(x + 7, y); }
+
+				for (int i = 0; i < 8; i++) {
+					if (!(mask & (1 << (2 * i)))) { continue; }
+					const uint8_t* from = srcColor + (x + i) * colorBytes;
+					uint8_t* to = dstColor + (x + i) * colorBytes;
+					to[0] = from[0]; to[1] = from[1]; to[2] = from[2];
+					if (colorBytes == 4) { to[3] = from[3]; }
+				}
+			}
+#endif
+			for (; x <= target.maxX; x++) {
+				if (srcZ[x] >= dstZ[x]) { continue; }
+				dstZ[x] = srcZ[x];
+				if (hiZ) { zSurface->markZWritten(x, y); }
+				const uint8_t* from = srcColor + x * colorBytes;
+				uint8_t* to = dstColor + x * colorBytes;
+				to[0] = from[0]; to[1] = from[1]; to[2] = from[2];
+				if (colorBytes == 4) { to[3] = from[3]; }
+			}
+		}
+	}
+
+	bool DrawingContext::clipSetup(const TriangleSetup & setup, int minX, int minY, int maxX, int maxY, TriangleSetup & clipped) const {
+		clipped = setup;
+		clipped.minX = std::max(setup.minX, minX); clipped.maxX = std::min(setup.maxX, maxX);
+		clipped.minY = std::max(setup.minY, minY); clipped.maxY = std::min(setup.maxY, maxY);
+		if (clipped.minX > clipped.maxX || clipped.minY > clipped.maxY)
+			return false;
+
+		//move the starting edge values to the new first pixel; still exact, since the deltas are whole numbers
+		clipped.e1 += (clipped.minX - setup.minX) * setup.e1dx + (clipped.minY - setup.minY) * setup.e1dy;
+		clipped.e2 += (clipped.minX - setup.minX) * setup.e2dx + (clipped.minY - setup.minY) * setup.e2dy;
+
+		//the float attribute planes stay where they are (at originX, originY): moving them would round differently,
+		//and a pixel has to come out the same whatever tile it was drawn in. The fixed point planes are exact.
+		const int dx = clipped.minX - setup.minX, dy = clipped.minY - setup.minY;
+		if (setup.fixedPoint) {
+			clipped.fe1 += dx * setup.fe1dx + dy * setup.fe1dy;
+			clipped.fe2 += dx * setup.fe2dx + dy * setup.fe2dy;
+			FixedPlane* fixedPlanes[] = { &clipped.fz, &clipped.fred, &clipped.fgreen, &clipped.fblue, &clipped.falpha, &clipped.fs, &clipped.ft };
+			for (FixedPlane* plane : fixedPlanes)
+				plane->v0 = plane->at(dx, dy);
+		}
+		return true;
+	}
+
+	BlockCoverage DrawingContext::classifyBlock(const TriangleSetup & setup, int minX, int minY, int maxX, int maxY) const {
+		//edge functions are linear too, so over a rectangle they are smallest and largest at its corners
+		const float e1 = setup.e1 + (minX - setup.minX) * setup.e1dx + (minY - setup.minY) * setup.e1dy;
+		const float e2 = setup.e2 + (minX - setup.minX) * setup.e2dx + (minY - setup.minY) * setup.e2dy;
+		const float edges[3][3] = {
+			{ e1, setup.e1dx, setup.e1dy },
+			{ e2, setup.e2dx, setup.e2dy },
+			{ setup.denom - e1 - e2, -setup.e1dx - setup.e2dx, -setup.e1dy - setup.e2dy },
+		};
+
+		BlockCoverage coverage = BLOCK_INSIDE;
+		for (int i = 0; i < 3; i++) {
+			const float dx = (maxX - minX) * edges[i][1], dy = (maxY - minY) * edges[i][2];
+			if (edges[i][0] + std::max(0.0f, dx) + std::max(0.0f, dy) < 0)
+				return BLOCK_OUTSIDE; //every pixel is on the wrong side of this edge
+			if (edges[i][0] + std::min(0.0f, dx) + std::min(0.0f, dy) < 0)
+				coverage = BLOCK_PARTIAL;
+		}
+		return coverage;
+	}
+
+	float DrawingContext::nearestZ(const TriangleSetup & setup, int minX, int minY, int maxX, int maxY) const {
+		//Z is linear, so over a rectangle it is smallest at one of the corners
+		float Z = setup.z.at(minX - setup.originX, minY - setup.originY);
+		Z += std::min(0.0f, (maxX - minX) * setup.z.dx) + std::min(0.0f, (maxY - minY) * setup.z.dy);
+
+		//the triangle itself is never nearer than its nearest vertex
+		return std::max(Z, setup.zMin) - setup.zMargin;
+	}
+
+	bool DrawingContext::isCulled(float signedArea) const {
+
+		if (signedArea == 0)
+			return true; //all points lie on a line or on the same point, so do not draw.
+		if (m_cullMode == CULL_NONE)
+			return false;
+
+		//positive area means counter-clockwise with y up, which is also how surface rows are numbered
+		const bool frontFacing = ((signedArea > 0) == (m_frontFace == FRONT_FACE_COUNTER_CLOCKWISE));
+		return frontFacing == (m_cullMode == CULL_FRONT);
+	}
+
+	bool DrawingContext::isCulled(const Vertex * v1, const Vertex * v2, const Vertex * v3) const {
+		//twice the signed area, before any transform work is spent on the triangle
+		return isCulled((v2->x - v1->x) * (v3->y - v1->y) - (v3->x - v1->x) * (v2->y - v1->y));
+	}
+
+	void DrawingContext::transformVertex(ISurface * drawingSurface, const Vertex & vertex, Vertex & transformed) const {
+
+		//converts a vertex to surface coordinates, Z buffer units and texels
+		transformed = vertex;
+		const Rect viewport = getViewportRect(drawingSurface);
+		if (m_rasterMode == RASTER_MODE_SUBPIXEL) {
+			//28.4 fixed point: round to the nearest 1/16 pixel instead of dropping the fraction (exact in a float)
+			transformed.x = floor((viewport.x + (viewport.width - 1) * ((vertex.x + 1.0) / 2.0)) * 16 + .5) / 16;
+			transformed.y = floor((viewport.y + (viewport.height - 1) * ((vertex.y + 1.0) / 2.0)) * 16 + .5) / 16;
+		}
+		else {
+			transformed.x = (int)(viewport.x + (viewport.width - 1) * ((vertex.x + 1.0) / 2.0)); //basically finding where the vertex is on the surface (endpoint to surface values).
+			transformed.y = (int)(viewport.y + (viewport.height - 1) * ((vertex.y + 1.0) / 2.0));
+		}
+		transformed.z = (65535)*((vertex.z + 1.0) / 2.0); //this is for z buffering
 
 		if (m_textureMap != nullptr) {
-			vertex1.s = vertex1.s * m_textureMap->getWidth();
-			vertex1.t = vertex1.t * m_textureMap->getHeight();
+			transformed.s = vertex.s * m_textureMap->getWidth();
+			transformed.t = vertex.t * m_textureMap->getHeight();
+		}
+	}
 
-			vertex2.s = vertex2.s * m_textureMap->getWidth();
-			vertex2.t = vertex2.t * m_textureMap->getHeight();
+	Rect DrawingContext::getViewportRect(ISurface * drawingSurface) const {
+		return m_hasViewport ? m_viewport : Rect(0, 0, drawingSurface->getWidth(), drawingSurface->getHeight());
+	}
 
-			vertex3.s = vertex3.s * m_textureMap->getWidth();
-			vertex3.t = vertex3.t * m_textureMap->getHeight();
+	bool DrawingContext::getClipRect(ISurface * drawingSurface, int & minX, int & minY, int & maxX, int & maxY) const {
+
+		//the pixels that may be drawn: the surface, the viewport and the scissor rectangle all at once (max is inclusive)
+		const Rect viewport = getViewportRect(drawingSurface);
+		minX = std::max(0, viewport.x); maxX = std::min((int)drawingSurface->getWidth(), viewport.x + (int)viewport.width) - 1;
+		minY = std::max(0, viewport.y); maxY = std::min((int)drawingSurface->getHeight(), viewport.y + (int)viewport.height) - 1;
+		if (m_hasScissor) {
+			minX = std::max(minX, m_scissor.x); maxX = std::min(maxX, m_scissor.x + (int)m_scissor.width - 1);
+			minY = std::max(minY, m_scissor.y); maxY = std::min(maxY, m_scissor.y + (int)m_scissor.height - 1);
 		}
+		return minX <= maxX && minY <= maxY;
+	}
 
-		//calculate values for "bounding box" for the for loop
-		float minX = std::min(vertex1.x, std::min(vertex2.x, vertex3.x));
-		float maxX = std::max(vertex1.x, std::max(vertex2.x, vertex3.x));
-		float minY = std::min(vertex1.y, std::min(vertex2.y, vertex3.y));
-		float maxY = std::max(vertex1.y, std::max(vertex2.y, vertex3.y));
+	GuardBand DrawingContext::getGuardBand(ISurface * drawingSurface) const {
 
-		Color drawColor;
-		float a1, a2, a3, Z;
-
-		for (float y = minY - .5; y < maxY + 1; y++) { // iterate through the bounding box by 1 pixel, starting on the halfway point of the pixel
-			for (float x = minX - .5; x < maxX + 1; x++) { // to the top left and going to halfway through the pixel to the bottom right.
-
-				const float denom = ((vertex2.y - vertex3.y)*(vertex1.x - vertex3.x) + (vertex3.x - vertex2.x)*(vertex1.y - vertex3.y));
-				const float xdiff = (x - vertex3.x);
-				const float ydiff = (y - vertex3.y);
-				a1 = ((vertex2.y - vertex3.y)*xdiff + (vertex3.x - vertex2.x)*ydiff) / denom;
-				a2 = ((vertex3.y - vertex1.y)*xdiff + (vertex1.x - vertex3.x)*ydiff) / denom;
-				a3 = 1 - a1 - a2;
-
-				Z = vertex1.z*a1 + vertex2.z*a2 + vertex3.z*a3;
-
-				if ((a1 < -.0000001) || (a2 < -.0000001) || (a3 < -.0000001) || (((zBuffer != nullptr)) && (Z >= zBuffer->getZ(x, y)))) { continue; } //pixel not in triangle or Z value is greater so skip
-				//if we get to this point then we set the Z, calculate the color, and draw the pixel.
-				if (zBuffer != nullptr) { zBuffer->setZ(x, y, Z); }
-
-				//This will calculate color from lamda values
-				drawColor.red = (vertex1.color.red * 255 * a1 + vertex2.color.red * 255 * a2 + vertex3.color.red * 255 * a3);
-				drawColor.green = (vertex1.color.green * 255 * a1 + vertex2.color.green * 255 * a2 + vertex3.color.green * 255 * a3);
-				drawColor.blue = (vertex1.color.blue * 255 * a1 + vertex2.color.blue * 255 * a2 + vertex3.color.blue * 255 * a3);
-				drawColor.alpha = (vertex1.color.alpha * 255 * a1 + vertex2.color.alpha * 255 * a2 + vertex3.color.alpha * 255 * a3);
-
-
-				if (m_textureMap != nullptr) { // This will get your texture calculations
-
-					float S = vertex1.s*a1 + vertex2.s*a2 + vertex3.s*a3; float T = vertex1.t*a1 + vertex2.t*a2 + vertex3.t*a3;
-					Color textureColor;
-
-					// This is the filter mode
-					if (m_filterMode == TEXTURE_FILTERING_MODE_BILINEAR) {
-
-						//this sets up values
-						float dx = S - floor(S) - .5; float dy = T - floor(T) - .5;
-						//dist from pix center
-						float adx = fabs(dx); float ady = fabs(dy);
-						float diffx = adx * (1 - ady); //for use in calculations
-						float diffy = (1 - adx) * ady;
-						float diffxy = adx * ady;
-						float identical = (1 - adx) * (1 - ady);
-
-						Color TL, TR, BL, BR; //color objects for top left, top right, bottom left, and bottom right texels
-						//bulk of code starts here
-						if (dy >= 0 && dx >= 0) { // TOP LEFT IS CURRENT TEXEL
-												  // we set the colors to the appropriate pixels using the wrap mode method so that we can determine the correct pixel regardless of wrap mode
-							TL = getTexelbyWrapMode(m_textureMap, m_wrapMode, S, T); TR = getTexelbyWrapMode(m_textureMap, m_wrapMode, S + 1, T); 
-							BL = getTexelbyWrapMode(m_textureMap, m_wrapMode, S, T + 1);  BR = getTexelbyWrapMode(m_textureMap, m_wrapMode, S + 1, T + 1); 
-							
-							//calculate the colors based on the formula
-							textureColor.alpha = TL.alpha	* identical + TR.alpha	* diffx + BL.alpha	* diffy + BR.alpha	* diffxy;
-							textureColor.red = TL.red	* identical + TR.red		* diffx + BL.red	* diffy + BR.red	* diffxy;
-							textureColor.green = TL.green	* identical + TR.green	* diffx + BL.green	* diffy + BR.green	* diffxy;
-							textureColor.blue = TL.blue	* identical + TR.blue	* diffx + BL.blue	* diffy + BR.blue	* diffxy;
-						}
-						else if (dy >= 0 && dx < 0) { //if this code runs then the top right is the current texel
-							TL = getTexelbyWrapMode(m_textureMap, m_wrapMode, S - 1, T); TR = getTexelbyWrapMode(m_textureMap, m_wrapMode, S, T);
-							BL = getTexelbyWrapMode(m_textureMap, m_wrapMode, S - 1, T + 1); BR = getTexelbyWrapMode(m_textureMap, m_wrapMode, S, T + 1);
-
-							textureColor.alpha = TL.alpha	* diffx + TR.alpha	* identical + BL.alpha	* diffxy + BR.alpha	* diffy;
-							textureColor.red = TL.red	* diffx + TR.red	* identical + BL.red		* diffxy + BR.red	* diffy;
-							textureColor.green = TL.green	* diffx + TR.green	* identical + BL.green	* diffxy + BR.green	* diffy;
-							textureColor.blue = TL.blue	* diffx + TR.blue	* identical + BL.blue	* diffxy + BR.blue	* diffy;
-						}
-						else if (dy < 0 && dx >= 0) { // if this code runs then bottom left is the current texel
-							TL = getTexelbyWrapMode(m_textureMap, m_wrapMode, S, T - 1); TR = getTexelbyWrapMode(m_textureMap, m_wrapMode, S + 1, T - 1);
-							BL = getTexelbyWrapMode(m_textureMap, m_wrapMode, S, T); BR = getTexelbyWrapMode(m_textureMap, m_wrapMode, S + 1, T);
-
-							textureColor.alpha = TL.alpha	* diffy + TR.alpha	* diffxy + BL.alpha	* identical + BR.alpha	* diffx;
-							textureColor.red = TL.red	* diffy + TR.red	* diffxy + BL.red	* identical + BR.red		* diffx;
-							textureColor.green = TL.green	* diffy + TR.green	* diffxy + BL.green	* identical + BR.green	* diffx;
-							textureColor.blue = TL.blue	* diffy + TR.blue	* diffxy + BL.blue	* identical + BR.blue	* diffx;
-						}
-						else if (dx < 0 && dy < 0) { // if this code runs then bottom right is the current texel.
-							TL = getTexelbyWrapMode(m_textureMap, m_wrapMode, S - 1, T - 1);
-							TR = getTexelbyWrapMode(m_textureMap, m_wrapMode, S, T - 1);
-							BL = getTexelbyWrapMode(m_textureMap, m_wrapMode, S - 1, T);
-							BR = getTexelbyWrapMode(m_textureMap, m_wrapMode, S, T);
-
-							//color starts here
-							textureColor.alpha = TL.alpha	* diffxy + TR.alpha	* diffy + BL.alpha	* diffx + BR.alpha	* identical;
-							textureColor.red = TL.red	* diffxy + TR.red	* diffy + BL.red	* diffx + BR.red	* identical;
-							textureColor.green = TL.green	* diffxy + TR.green	* diffy + BL.green	* diffx + BR.green	* identical;
-							textureColor.blue = TL.blue	* diffxy + TR.blue	* diffy + BL.blue	* diffx + BR.blue	* identical;
+		//GUARD_BAND pixels past each edge of the viewport, in vertex coordinates
+		const Rect viewport = getViewportRect(drawingSurface);
+		const float bandX = 2.0f * GUARD_BAND / std::max((int)viewport.width - 1, 1);
+		const float bandY = 2.0f * GUARD_BAND / std::max((int)viewport.height - 1, 1);
+
+		GuardBand band;
+		band.minX = -1 - bandX; band.maxX = 1 + bandX;
+		band.minY = -1 - bandY; band.maxY = 1 + bandY;
+		return band;
+	}
+
+	Vertex DrawingContext::interpolateVertex(const Vertex & vA, const Vertex & vB, float t) const {
+
+		Vertex vertex;
+		vertex.x = vA.x + (vB.x - vA.x) * t; vertex.y = vA.y + (vB.y - vA.y) * t; vertex.z = vA.z + (vB.z - vA.z) * t;
+		vertex.color.red = vA.color.red + (vB.color.red - vA.color.red) * t;
+		vertex.color.green = vA.color.green + (vB.color.green - vA.color.green) * t;
+		vertex.color.blue = vA.color.blue + (vB.color.blue - vA.color.blue) * t;
+		vertex.color.alpha = vA.color.alpha + (vB.color.alpha - vA.color.alpha) * t;
+		vertex.s = vA.s + (vB.s - vA.s) * t; vertex.t = vA.t + (vB.t - vA.t) * t;
+		return vertex;
+	}
+
+	uint32_t DrawingContext::clipToGuardBand(ISurface * drawingSurface, const GuardBand & band, const Vertex * v1, const Vertex * v2, const Vertex * v3, TriangleSetup * setups) const {
+
+		//Sutherland-Hodgman against one guard band edge at a time; each edge adds at most one vertex
+		Vertex polygons[2][MAX_CLIPPED_TRIANGLES + 2];
+		Vertex* polygon = polygons[0]; Vertex* clipped = polygons[1];
+		polygon[0] = *v1; polygon[1] = *v2; polygon[2] = *v3;
+		uint32_t count = 3;
+
+		struct ClipEdge { bool isX; float limit; float side; }; //inside is where side * (coordinate - limit) <= 0
+		const ClipEdge edges[] = { { true, band.minX, -1 }, { true, band.maxX, 1 }, { false, band.minY, -1 }, { false, band.maxY, 1 } };
+
+		for (const ClipEdge& edge : edges) {
+			uint32_t clippedCount = 0;
+			for (uint32_t i = 0; i < count; i++) {
+				const Vertex& current = polygon[i]; const Vertex& next = polygon[(i + 1) % count];
+				const float currentDistance = edge.side * ((edge.isX ? current.x : current.y) - edge.limit);
+				const float nextDistance = edge.side * ((edge.isX ? next.x : next.y) - edge.limit);
+
+				if (currentDistance <= 0)
+					clipped[clippedCount++] = current;
+				if ((currentDistance <= 0) != (nextDistance <= 0))
+					clipped[clippedCount++] = interpolateVertex(current, next, currentDistance / (currentDistance - nextDistance));
+			}
+
+			std::swap(polygon, clipped);
+			count = clippedCount;
+			if (count < 3)
+				return 0; //entirely outside
+		}
+
+		//what's left is convex, so draw it as a fan
+		Vertex transformed[MAX_CLIPPED_TRIANGLES + 2];
+		for (uint32_t i = 0; i < count; i++)
+			transformVertex(drawingSurface, polygon[i], transformed[i]);
+
+		for (uint32_t i = 1; i + 1 < count; i++) {
+			TriangleSetup& setup = setups[i - 1];
+			setup.v1 = transformed[0]; setup.v2 = transformed[i]; setup.v3 = transformed[i + 1];
+		}
+		return count - 2;
+	}
+
+	uint32_t DrawingContext::prepareTriangle(ISurface * drawingSurface, const GuardBand & band, const Vertex * v1, const Vertex * v2, const Vertex * v3, TriangleSetup * setups) const {
+
+		if (isCulled(v1, v2, v3))
+			return 0; //no area, or facing the wrong way
+
+		//only triangles that reach far outside the viewport need real clipping; the rest just get their
+		//bounding box cut down to the visible pixels, so they cost no more than what they cover
+		if (!band.contains(*v1) || !band.contains(*v2) || !band.contains(*v3))
+			return clipToGuardBand(drawingSurface, band, v1, v2, v3, setups);
+
+		transformVertex(drawingSurface, *v1, setups[0].v1);
+		transformVertex(drawingSurface, *v2, setups[0].v2);
+		transformVertex(drawingSurface, *v3, setups[0].v3);
+		return 1;
+	}
+
+	uint32_t DrawingContext::setupTransformedTriangles(ISurface * drawingSurface, TriangleSetup * setups, uint32_t count) const {
+
+		//the ones that are left get packed to the front, in order
+		uint32_t i = 0, setupCount = 0;
+#ifdef CTXGRAF_SSE2
+		if (m_rasterMode == RASTER_MODE_PIXEL) {
+			for (; i + 4 <= count; i += 4)
+				setupCount += setupFourTriangles(drawingSurface, setups + i, setups + setupCount);
+		}
+#endif
+		for (; i < count; i++) {
+			if (!setupTransformedTriangle(drawingSurface, setups[i]))
+				continue;
+			if (setupCount != i)
+				setups[setupCount] = setups[i];
+			setupCount++;
+		}
+		return setupCount;
+	}
+
+	bool DrawingContext::setupTransformedTriangle(ISurface * drawingSurface, TriangleSetup & setup) const {
+
+		const Vertex& vertex1 = setup.v1; const Vertex& vertex2 = setup.v2; const Vertex& vertex3 = setup.v3;
+
+		setup.fixedPoint = (m_rasterMode == RASTER_MODE_SUBPIXEL);
+		if (setup.fixedPoint) {
+			if (!setupFixedTriangle(drawingSurface, setup))
+				return false;
+		}
+		else {
+			//twice the signed area; snapping can still collapse a thin triangle to nothing, or even turn it over
+			setup.denom = ((vertex2.y - vertex3.y)*(vertex1.x - vertex3.x) + (vertex3.x - vertex2.x)*(vertex1.y - vertex3.y));
+			if (isCulled(setup.denom))
+				return false;
+
+			//edge function i is the numerator of barycentric weight i, so it only ever changes by a constant per pixel
+			setup.e1dx = vertex2.y - vertex3.y; setup.e1dy = vertex3.x - vertex2.x;
+			setup.e2dx = vertex3.y - vertex1.y; setup.e2dy = vertex1.x - vertex3.x;
+
+			//flip clockwise triangles so "inside" is always e >= 0; the weights (e / denom) come out the same
+			if (setup.denom < 0) {
+				setup.denom = -setup.denom;
+				setup.e1dx = -setup.e1dx; setup.e1dy = -setup.e1dy;
+				setup.e2dx = -setup.e2dx; setup.e2dy = -setup.e2dy;
+			}
+			setup.invDenom = 1.0f / setup.denom;
+
+			//bounding box in whole pixels. Pixel p is sampled at its center (p + .5), so the first pixel that
+			//can be covered is the one just left of / above the leftmost / topmost vertex.
+			setup.minX = (int)std::min(vertex1.x, std::min(vertex2.x, vertex3.x)) - 1;
+			setup.maxX = (int)std::max(vertex1.x, std::max(vertex2.x, vertex3.x));
+			setup.minY = (int)std::min(vertex1.y, std::min(vertex2.y, vertex3.y)) - 1;
+			setup.maxY = (int)std::max(vertex1.y, std::max(vertex2.y, vertex3.y));
+
+			//clamp to the visible pixels so that nothing else is ever visited
+			int clipMinX, clipMinY, clipMaxX, clipMaxY;
+			getClipRect(drawingSurface, clipMinX, clipMinY, clipMaxX, clipMaxY);
+			setup.minX = std::max(setup.minX, clipMinX); setup.maxX = std::min(setup.maxX, clipMaxX);
+			setup.minY = std::max(setup.minY, clipMinY); setup.maxY = std::min(setup.maxY, clipMaxY);
+			if (setup.minX > setup.maxX || setup.minY > setup.maxY)
+				return false;
+			setup.originX = setup.minX; setup.originY = setup.minY;
+
+			//edge values at the center of the first pixel; everything after this is done by adding deltas
+			const float xdiff = (setup.minX + .5f) - vertex3.x;
+			const float ydiff = (setup.minY + .5f) - vertex3.y;
+			setup.e1 = setup.e1dx * xdiff + setup.e1dy * ydiff;
+			setup.e2 = setup.e2dx * xdiff + setup.e2dy * ydiff;
+		}
+
+		//every attribute as a plane over the screen: the rasterizer steps these instead of weighting three
+		//vertex values per pixel, and Z as a plane also lets whole blocks be checked against hierarchical Z
+		auto makePlane = [&setup](float value1, float value2, float value3, AttributePlane& plane) {
+			const float d13 = value1 - value3, d23 = value2 - value3;
+			plane.dx = (d13 * setup.e1dx + d23 * setup.e2dx) * setup.invDenom;
+			plane.dy = (d13 * setup.e1dy + d23 * setup.e2dy) * setup.invDenom;
+			plane.v0 = value3 + (d13 * setup.e1 + d23 * setup.e2) * setup.invDenom;
+		};
+		makePlane(vertex1.z, vertex2.z, vertex3.z, setup.z);
+		makePlane(vertex1.color.red * 255, vertex2.color.red * 255, vertex3.color.red * 255, setup.red);
+		makePlane(vertex1.color.green * 255, vertex2.color.green * 255, vertex3.color.green * 255, setup.green);
+		makePlane(vertex1.color.blue * 255, vertex2.color.blue * 255, vertex3.color.blue * 255, setup.blue);
+		makePlane(vertex1.color.alpha * 255, vertex2.color.alpha * 255, vertex3.color.alpha * 255, setup.alpha);
+		makePlane(vertex1.s, vertex2.s, vertex3.s, setup.s);
+		makePlane(vertex1.t, vertex2.t, vertex3.t, setup.t);
+
+		setup.flatColor = (vertex1.color.red == vertex2.color.red && vertex1.color.red == vertex3.color.red
+			&& vertex1.color.green == vertex2.color.green && vertex1.color.green == vertex3.color.green
+			&& vertex1.color.blue == vertex2.color.blue && vertex1.color.blue == vertex3.color.blue
+			&& vertex1.color.alpha == vertex2.color.alpha && vertex1.color.alpha == vertex3.color.alpha);
+
+		setup.zMin = std::min(vertex1.z, std::min(vertex2.z, vertex3.z));
+		setup.zMargin = 1 + (fabs(setup.z.dx) * (setup.maxX - setup.minX + 1) + fabs(setup.z.dy) * (setup.maxY - setup.minY + 1) + 65536) * 1e-6f;
+
+		return true;
+	}
+
+#ifdef CTXGRAF_SSE2
+	uint32_t DrawingContext::setupFourTriangles(ISurface * drawingSurface, const TriangleSetup * triangles, TriangleSetup * setups) const {
+
+		//setupTransformedTriangle() for RASTER_MODE_PIXEL, with triangle i in lane i. Every step is the same
+		//operation in the same order as there, so the setups come out identical.
+		enum { X, Y, Z, RED, GREEN, BLUE, ALPHA, S, T, VERTEX_ATTRIBUTE_COUNT };
+		alignas(16) float gathered[3][VERTEX_ATTRIBUTE_COUNT][4];
+		for (int i = 0; i < 4; i++) {
+			const Vertex* vertices[3] = { &triangles[i].v1, &triangles[i].v2, &triangles[i].v3 };
+			for (int v = 0; v < 3; v++) {
+				gathered[v][X][i] = vertices[v]->x; gathered[v][Y][i] = vertices[v]->y; gathered[v][Z][i] = vertices[v]->z;
+				gathered[v][RED][i] = vertices[v]->color.red; gathered[v][GREEN][i] = vertices[v]->color.green;
+				gathered[v][BLUE][i] = vertices[v]->color.blue; gathered[v][ALPHA][i] = vertices[v]->color.alpha;
+				gathered[v][S][i] = vertices[v]->s; gathered[v][T][i] = vertices[v]->t;
+			}
+		}
+		__m128 vertex[3][VERTEX_ATTRIBUTE_COUNT];
+		for (int v = 0; v < 3; v++) {
+			for (int a = 0; a < VERTEX_ATTRIBUTE_COUNT; a++)
+				vertex[v][a] = _mm_load_ps(gathered[v][a]);
+		}
+
+		//compared before scaling, like the scalar setup does
+		__m128 sameColor = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int a = RED; a <= ALPHA; a++)
+			sameColor = _mm_and_ps(sameColor, _mm_and_ps(_mm_cmpeq_ps(vertex[0][a], vertex[1][a]), _mm_cmpeq_ps(vertex[0][a], vertex[2][a])));
+		const int flatColor = _mm_movemask_ps(sameColor);
+
+		const __m128 colorScale = _mm_set1_ps(255);
+		for (int v = 0; v < 3; v++) {
+			for (int a = RED; a <= ALPHA; a++)
+				vertex[v][a] = _mm_mul_ps(vertex[v][a], colorScale);
+		}
+		const __m128 x1 = vertex[0][X], y1 = vertex[0][Y], x2 = vertex[1][X], y2 = vertex[1][Y], x3 = vertex[2][X], y3 = vertex[2][Y];
+
+		//twice the signed area, and the same cull decision isCulled() makes
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+		__m128 denom = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(y2, y3), _mm_sub_ps(x1, x3)), _mm_mul_ps(_mm_sub_ps(x3, x2), _mm_sub_ps(y1, y3)));
+		int rejected = _mm_movemask_ps(_mm_cmpeq_ps(denom, zero));
+		if (m_cullMode != CULL_NONE) {
+			const int positive = _mm_movemask_ps(_mm_cmpgt_ps(denom, zero));
+			const int frontFacing = (m_frontFace == FRONT_FACE_COUNTER_CLOCKWISE ? positive : ~positive) & 0xF;
+			rejected |= (m_cullMode == CULL_FRONT ? frontFacing : ~frontFacing & 0xF);
+		}
+		if (rejected == 0xF)
+			return 0;
+
+		//edge steps, flipped (by their sign bit, which is exact) for clockwise triangles
+		__m128 e1dx = _mm_sub_ps(y2, y3), e1dy = _mm_sub_ps(x3, x2);
+		__m128 e2dx = _mm_sub_ps(y3, y1), e2dy = _mm_sub_ps(x1, x3);
+		const __m128 flip = _mm_and_ps(_mm_cmplt_ps(denom, zero), _mm_set1_ps(-0.0f));
+		denom = _mm_xor_ps(denom, flip);
+		e1dx = _mm_xor_ps(e1dx, flip); e1dy = _mm_xor_ps(e1dy, flip);
+		e2dx = _mm_xor_ps(e2dx, flip); e2dy = _mm_xor_ps(e2dy, flip);
+		const __m128 invDenom = _mm_div_ps(one, denom);
+
+		//bounding box, clamped to the visible pixels. Vertices are on whole pixels in this raster mode,
+		//so it can stay in floats without anything being rounded.
+		int clipMinX, clipMinY, clipMaxX, clipMaxY;
+		getClipRect(drawingSurface, clipMinX, clipMinY, clipMaxX, clipMaxY);
+		const __m128 minX = _mm_max_ps(_mm_sub_ps(_mm_min_ps(x1, _mm_min_ps(x2, x3)), one), _mm_set1_ps((float)clipMinX));
+		const __m128 maxX = _mm_min_ps(_mm_max_ps(x1, _mm_max_ps(x2, x3)), _mm_set1_ps((float)clipMaxX));
+		const __m128 minY = _mm_max_ps(_mm_sub_ps(_mm_min_ps(y1, _mm_min_ps(y2, y3)), one), _mm_set1_ps((float)clipMinY));
+		const __m128 maxY = _mm_min_ps(_mm_max_ps(y1, _mm_max_ps(y2, y3)), _mm_set1_ps((float)clipMaxY));
+		rejected |= _mm_movemask_ps(_mm_or_ps(_mm_cmpgt_ps(minX, maxX), _mm_cmpgt_ps(minY, maxY)));
+		if (rejected == 0xF)
+			return 0;
+
+		const __m128 half = _mm_set1_ps(.5f);
+		const __m128 xdiff = _mm_sub_ps(_mm_add_ps(minX, half), x3), ydiff = _mm_sub_ps(_mm_add_ps(minY, half), y3);
+		const __m128 e1 = _mm_add_ps(_mm_mul_ps(e1dx, xdiff), _mm_mul_ps(e1dy, ydiff));
+		const __m128 e2 = _mm_add_ps(_mm_mul_ps(e2dx, xdiff), _mm_mul_ps(e2dy, ydiff));
+
+		//everything that goes into a TriangleSetup, a register per field
+		enum { DENOM, INV_DENOM, E1DX, E1DY, E2DX, E2DY, E1, E2, MIN_X, MAX_X, MIN_Y, MAX_Y, Z_MIN, Z_MARGIN, PLANES };
+		static const int PLANE_COUNT = T - Z + 1, FIELD_COUNT = PLANES + 3 * PLANE_COUNT;
+		__m128 fields[FIELD_COUNT] = { denom, invDenom, e1dx, e1dy, e2dx, e2dy, e1, e2, minX, maxX, minY, maxY };
+
+		for (int p = 0; p < PLANE_COUNT; p++) {
+			const __m128 d13 = _mm_sub_ps(vertex[0][Z + p], vertex[2][Z + p]), d23 = _mm_sub_ps(vertex[1][Z + p], vertex[2][Z + p]);
+			fields[PLANES + 3 * p] = _mm_add_ps(vertex[2][Z + p], _mm_mul_ps(_mm_add_ps(_mm_mul_ps(d13, e1), _mm_mul_ps(d23, e2)), invDenom));
+			fields[PLANES + 3 * p + 1] = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(d13, e1dx), _mm_mul_ps(d23, e2dx)), invDenom);
+			fields[PLANES + 3 * p + 2] = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(d13, e1dy), _mm_mul_ps(d23, e2dy)), invDenom);
+		}
+
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+		const __m128 width = _mm_add_ps(_mm_sub_ps(maxX, minX), one), height = _mm_add_ps(_mm_sub_ps(maxY, minY), one);
+		fields[Z_MIN] = _mm_min_ps(vertex[0][Z], _mm_min_ps(vertex[1][Z], vertex[2][Z]));
+		fields[Z_MARGIN] = _mm_add_ps(one, _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(fields[PLANES + 1], absMask), width),
+			_mm_mul_ps(_mm_and_ps(fields[PLANES + 2], absMask), height)), _mm_set1_ps(65536)), _mm_set1_ps(1e-6f)));
+
+		//back to one TriangleSetup per lane, packed to the front of setups
+		alignas(16) float lanes[FIELD_COUNT][4];
+		for (int f = 0; f < FIELD_COUNT; f++)
+			_mm_store_ps(lanes[f], fields[f]);
+
+		uint32_t setupCount = 0;
+		for (int i = 0; i < 4; i++) {
+			if (rejected & (1 << i))
+				continue;
+
+			TriangleSetup& setup = setups[setupCount++];
+			if (&setup != &triangles[i]) {
+				setup.v1 = triangles[i].v1; setup.v2 = triangles[i].v2; setup.v3 = triangles[i].v3;
+			}
+			setup.fixedPoint = false;
+			setup.denom = lanes[DENOM][i]; setup.invDenom = lanes[INV_DENOM][i];
+			setup.e1dx = lanes[E1DX][i]; setup.e1dy = lanes[E1DY][i];
+			setup.e2dx = lanes[E2DX][i]; setup.e2dy = lanes[E2DY][i];
+			setup.e1 = lanes[E1][i]; setup.e2 = lanes[E2][i];
+			setup.minX = (int)lanes[MIN_X][i]; setup.maxX = (int)lanes[MAX_X][i];
+			setup.minY = (int)lanes[MIN_Y][i]; setup.maxY = (int)lanes[MAX_Y][i];
+			setup.originX = setup.minX; setup.originY = setup.minY;
+
+			AttributePlane* planes[PLANE_COUNT] = { &setup.z, &setup.red, &setup.green, &setup.blue, &setup.alpha, &setup.s, &setup.t };
+			for (int p = 0; p < PLANE_COUNT; p++) {
+				planes[p]->v0 = lanes[PLANES + 3 * p][i];
+				planes[p]->dx = lanes[PLANES + 3 * p + 1][i];
+				planes[p]->dy = lanes[PLANES + 3 * p + 2][i];
+			}
+			setup.zMin = lanes[Z_MIN][i]; setup.zMargin = lanes[Z_MARGIN][i];
+			setup.flatColor = ((flatColor >> i) & 1) != 0;
+		}
+		return setupCount;
+	}
+#endif
+
+	bool DrawingContext::setupFixedTriangle(ISurface * drawingSurface, TriangleSetup & setup) const {
+
+		const Vertex& vertex1 = setup.v1; const Vertex& vertex2 = setup.v2; const Vertex& vertex3 = setup.v3;
+
+		//vertices are already on the 1/16 pixel grid, so these are exact
+		const int64_t X1 = llround(vertex1.x * 16), Y1 = llround(vertex1.y * 16);
+		const int64_t X2 = llround(vertex2.x * 16), Y2 = llround(vertex2.y * 16);
+		const int64_t X3 = llround(vertex3.x * 16), Y3 = llround(vertex3.y * 16);
+
+		//same edge functions as the float setup, in 1/16 pixel units
+		int64_t A1 = Y2 - Y3, B1 = X3 - X2;
+		int64_t A2 = Y3 - Y1, B2 = X1 - X3;
+		int64_t denom = A1 * (X1 - X3) + B1 * (Y1 - Y3);
+		if (isCulled((float)denom))
+			return false;
+		if (denom < 0) {
+			denom = -denom;
+			A1 = -A1; B1 = -B1; A2 = -A2; B2 = -B2;
+		}
+		const int64_t A3 = -A1 - A2, B3 = -B1 - B2;
+
+		//pixel p is sampled at 16p + 8, so only pixels whose centers fall inside the vertices' extent can be covered
+		const int64_t minX = (std::min(X1, std::min(X2, X3)) + 7) >> 4, maxX = (std::max(X1, std::max(X2, X3)) - 8) >> 4;
+		const int64_t minY = (std::min(Y1, std::min(Y2, Y3)) + 7) >> 4, maxY = (std::max(Y1, std::max(Y2, Y3)) - 8) >> 4;
+		int clipMinX, clipMinY, clipMaxX, clipMaxY;
+		getClipRect(drawingSurface, clipMinX, clipMinY, clipMaxX, clipMaxY);
+		setup.minX = (int)std::max<int64_t>(minX, clipMinX); setup.maxX = (int)std::min<int64_t>(maxX, clipMaxX);
+		setup.minY = (int)std::max<int64_t>(minY, clipMinY); setup.maxY = (int)std::min<int64_t>(maxY, clipMaxY);
+		if (setup.minX > setup.maxX || setup.minY > setup.maxY)
+			return false;
+		setup.originX = setup.minX; setup.originY = setup.minY;
+
+		//top-left fill rule: a pixel center exactly on an edge only belongs to the triangle if the edge is a left edge
+		//(inside is to its right) or a top edge (horizontal, inside is below it). Shared edges are then drawn exactly once.
+		auto bias = [](int64_t A, int64_t B) -> int64_t { return (A > 0 || (A == 0 && B > 0)) ? 0 : -1; };
+
+		const int64_t xdiff = 16 * setup.minX + 8 - X3, ydiff = 16 * setup.minY + 8 - Y3;
+		const int64_t e1 = A1 * xdiff + B1 * ydiff, e2 = A2 * xdiff + B2 * ydiff;
+		setup.fe1dx = 16 * A1; setup.fe1dy = 16 * B1;
+		setup.fe2dx = 16 * A2; setup.fe2dy = 16 * B2;
+		setup.fe1 = e1 + bias(A1, B1); setup.fe2 = e2 + bias(A2, B2);
+		setup.fdenom = denom + bias(A1, B1) + bias(A2, B2) + bias(A3, B3);
+
+		//the float versions, in pixels, for the attribute planes and hierarchical Z
+		setup.e1dx = A1 / 16.0f; setup.e1dy = B1 / 16.0f;
+		setup.e2dx = A2 / 16.0f; setup.e2dy = B2 / 16.0f;
+		setup.e1 = (float)(e1 / 256.0); setup.e2 = (float)(e2 / 256.0);
+		setup.denom = (float)(denom / 256.0);
+		setup.invDenom = 1.0f / setup.denom;
+
+		//16.16 attribute planes, worked out in double from the exact edge values and rounded once
+		auto makePlane = [&](double value1, double value2, double value3, FixedPlane& plane) {
+			const double d13 = value1 - value3, d23 = value2 - value3;
+			plane.dx = llround((d13 * setup.fe1dx + d23 * setup.fe2dx) / denom * 65536);
+			plane.dy = llround((d13 * setup.fe1dy + d23 * setup.fe2dy) / denom * 65536);
+			plane.v0 = llround((value3 + (d13 * e1 + d23 * e2) / denom) * 65536);
+		};
+		makePlane(vertex1.z, vertex2.z, vertex3.z, setup.fz);
+		makePlane(vertex1.color.red * 255, vertex2.color.red * 255, vertex3.color.red * 255, setup.fred);
+		makePlane(vertex1.color.green * 255, vertex2.color.green * 255, vertex3.color.green * 255, setup.fgreen);
+		makePlane(vertex1.color.blue * 255, vertex2.color.blue * 255, vertex3.color.blue * 255, setup.fblue);
+		makePlane(vertex1.color.alpha * 255, vertex2.color.alpha * 255, vertex3.color.alpha * 255, setup.falpha);
+		makePlane(vertex1.s, vertex2.s, vertex3.s, setup.fs);
+		makePlane(vertex1.t, vertex2.t, vertex3.t, setup.ft);
+
+		return true;
+	}
+
+	void DrawingContext::rasterizeTriangle(ISurface * drawingSurface, IZBuffer * zBuffer, const TriangleSetup & setup) const {
+
+		//the drawing state was already looked at when the pipeline state was made, so all that is left is
+		//picking the kernel for the targets and the triangle
+		const PipelineState& pipeline = m_pipeline;
+		const int zTest = (zBuffer != nullptr ? 1 : 0);
+
+		//blended pixels have to be read back before they are written, which the blended kernels do a row at a time
+		if (pipeline.blended) {
+			(this->*pipeline.blendedKernels[setup.fixedPoint ? 1 : 0][zTest])(drawingSurface, zBuffer, setup);
+			return;
+		}
+
+		if (setup.fixedPoint) {
+			(this->*pipeline.fixedKernels[zTest])(drawingSurface, zBuffer, setup);
+			return;
+		}
+
+#ifdef CTXGRAF_SSE2
+		//the vector path writes straight into surface memory, so it needs to know the memory layout. The bounding box
+		//is only clamped to the drawing surface, so a smaller Z buffer goes through the interfaces (which check).
+		Surface* colorSurface = rowOrderSurface(drawingSurface);
+		Surface* zSurface = rowOrderSurface(zBuffer);
+		if (colorSurface != nullptr && (zBuffer == nullptr || (zSurface != nullptr && coversSurface(zSurface, colorSurface)))) {
+			(this->*pipeline.surfaceKernels[zTest][setup.flatColor ? 1 : 0])(colorSurface, zSurface, setup);
+			return;
+		}
+#endif
+
+		(this->*pipeline.genericKernels[zTest])(drawingSurface, zBuffer, setup);
+	}
+
+	template <bool Z_TEST, bool BLENDED, bool TEXTURED, TextureFilteringMode FILTER, TextureWrappingMode WRAP, TextureBlendingMode BLEND>
+	void DrawingContext::rasterizeTriangleGeneric(ISurface * drawingSurface, IZBuffer * zBuffer, const TriangleSetup & setup) const {
+
+		static thread_local BlendRow blendedRow;
+
+		for (int y = setup.minY; y <= setup.maxY; y++) {
+
+			if (BLENDED) { blendedRow.start(setup.minX, setup.maxX); }
+
+			//edge values at the start of the row; they are exact, so stepping along the row is one add each.
+			//Attributes are evaluated from their planes instead, so that they don't depend on where the row starts.
+			float e1 = setup.e1 + (y - setup.minY) * setup.e1dy, e2 = setup.e2 + (y - setup.minY) * setup.e2dy;
+			const int py = y - setup.originY;
+
+			for (int x = setup.minX; x <= setup.maxX; x++, e1 += setup.e1dx, e2 += setup.e2dx) {
+
+				//the third edge is whatever is left of the area, same as a3 = 1 - a1 - a2
+				const float e3 = setup.denom - e1 - e2;
+				if (e1 < 0 || e2 < 0 || e3 < 0) { continue; } //pixel not in triangle
+
+				const int px = x - setup.originX;
+				const float Z = setup.z.at(px, py);
+				const float red = setup.red.at(px, py), green = setup.green.at(px, py), blue = setup.blue.at(px, py), alpha = setup.alpha.at(px, py);
+				const float S = setup.s.at(px, py), T = setup.t.at(px, py);
+
+				if (Z_TEST && (Z >= zBuffer->getZ(x, y))) { continue; } //Z value is greater so skip
+				//if we get to this point then we calculate the color, set the Z, and draw the pixel.
+				const Color drawColor = shadePixel<TEXTURED, FILTER, WRAP, BLEND>(red, green, blue, alpha, S, T);
+				if (BLENDED && drawColor.alpha < m_pipeline.alphaTestThreshold) { continue; } //alpha test, before Z gets written
+				if (Z_TEST) { zBuffer->setZ(x, y, Z); }
+
+				if (BLENDED)
+					blendedRow.add(x, drawColor);
+				else
+					drawingSurface->drawPixel(x, y, drawColor);
+			}
+
+			if (BLENDED) { blendRow(drawingSurface, y, blendedRow); }
+		}
+	}
+
+	template <bool Z_TEST, bool BLENDED, bool TEXTURED, TextureFilteringMode FILTER, TextureWrappingMode WRAP, TextureBlendingMode BLEND>
+	void DrawingContext::rasterizeTriangleFixed(ISurface * drawingSurface, IZBuffer * zBuffer, const TriangleSetup & setup) const {
+
+		//write straight into surface memory when the layout is known, otherwise go through the interfaces
+		Surface* colorSurface = rowOrderSurface(drawingSurface);
+		//the bounding box is only clamped to the drawing surface, so a smaller Z buffer has to go through getZ()/setZ()
+		Surface* zSurface = rowOrderSurface(zBuffer);
+		if (zSurface != nullptr && (zSurface->getFormat() != PF_Z16 || !coversSurface(zSurface, drawingSurface)))
+			zSurface = nullptr;
+		uint8_t* colorStart = (colorSurface != nullptr ? static_cast<uint8_t*>(colorSurface->getStart()) : nullptr);
+		const uint32_t colorPitch = (colorSurface != nullptr ? colorSurface->getPitch() : 0);
+		const uint32_t colorBytes = (colorSurface != nullptr && colorSurface->getFormat() == PF_RGBA_8888 ? 4 : 3);
+		uint8_t* zStart = (zSurface != nullptr ? static_cast<uint8_t*>(zSurface->getStart()) : nullptr);
+		const uint32_t zPitch = (zSurface != nullptr ? zSurface->getPitch() : 0);
+		const bool hiZ = (zSurface != nullptr && zSurface->hasHiZ());
+
+		//16.16 color channel to the 0-255 value shadePixel expects; rounding in setup can leave it a hair outside
+		auto channel = [](int64_t value) { return (float)std::min<int64_t>(std::max<int64_t>(value >> 16, 0), 255); };
+
+		static thread_local BlendRow blendedRow;
+
+		for (int y = setup.minY; y <= setup.maxY; y++) {
+
+			if (BLENDED) { blendedRow.start(setup.minX, setup.maxX); }
+
+			//everything is whole numbers from here on, so the values for a pixel never depend on the path taken to it
+			const int py = y - setup.minY;
+			int64_t e1 = setup.fe1 + py * setup.fe1dy, e2 = setup.fe2 + py * setup.fe2dy;
+			int64_t Z = setup.fz.at(0, py);
+			int64_t red = setup.fred.at(0, py), green = setup.fgreen.at(0, py), blue = setup.fblue.at(0, py), alpha = setup.falpha.at(0, py);
+			int64_t S = setup.fs.at(0, py), T = setup.ft.at(0, py);
+
+			uint8_t* colorRow = (colorStart != nullptr ? colorStart + y * colorPitch : nullptr);
+			uint16_t* zRow = (zStart != nullptr ? reinterpret_cast<uint16_t*>(zStart + y * zPitch) : nullptr);
+
+			for (int x = setup.minX; x <= setup.maxX; x++, e1 += setup.fe1dx, e2 += setup.fe2dx, Z += setup.fz.dx,
+				red += setup.fred.dx, green += setup.fgreen.dx, blue += setup.fblue.dx, alpha += setup.falpha.dx, S += setup.fs.dx, T += setup.ft.dx) {
+
+				if (e1 < 0 || e2 < 0 || setup.fdenom - e1 - e2 < 0) { continue; } //pixel not in triangle
+
+				if (Z_TEST) {
+					const int64_t oldZ = (zRow != nullptr ? zRow[x] : zBuffer->getZ(x, y));
+					if (Z >= (oldZ << 16)) { continue; } //Z value is greater so skip
+				}
+
+				const Color drawColor = shadePixel<TEXTURED, FILTER, WRAP, BLEND>(channel(red), channel(green), channel(blue), channel(alpha), S / 65536.0f, T / 65536.0f);
+				if (BLENDED && drawColor.alpha < m_pipeline.alphaTestThreshold) { continue; } //alpha test, before Z gets written
+
+				if (Z_TEST) {
+					const uint32_t newZ = (uint32_t)std::min<int64_t>(std::max<int64_t>(Z >> 16, 0), 65535);
+					if (zRow != nullptr) {
+						zRow[x] = (uint16_t)newZ;
+						if (hiZ) { zSurface->markZWritten(x, y); }
+					}
+					else
+						zBuffer->setZ(x, y, newZ);
+				}
+
+				if (BLENDED)
+					blendedRow.add(x, drawColor);
+				else if (colorRow != nullptr)
+					storeColor(colorRow + x * colorBytes, colorBytes, drawColor);
+				else
+					drawingSurface->drawPixel(x, y, drawColor);
+			}
+
+			if (BLENDED) { blendRow(drawingSurface, y, blendedRow); }
+		}
+	}
+
+#ifdef CTXGRAF_SSE2
+	template <bool Z_TEST, bool FLAT, bool TEXTURED, TextureFilteringMode FILTER, TextureWrappingMode WRAP, TextureBlendingMode BLEND>
+	void DrawingContext::rasterizeTriangleSSE2(Surface * colorSurface, Surface * zSurface, const TriangleSetup & setup) const {
+
+		//one color and nothing to test: every covered pixel just gets that color
+		if (FLAT && !Z_TEST) {
+			fillFlatTriangle(colorSurface, setup);
+			return;
+		}
+
+		uint8_t* colorStart = static_cast<uint8_t*>(colorSurface->getStart());
+		const uint32_t colorPitch = colorSurface->getPitch();
+		const uint32_t colorBytes = (colorSurface->getFormat() == PF_RGBA_8888 ? 4 : 3);
+		uint8_t* zStart = (Z_TEST ? static_cast<uint8_t*>(zSurface->getStart()) : nullptr);
+		const uint32_t zPitch = (Z_TEST ? zSurface->getPitch() : 0);
+		const bool hiZ = (Z_TEST && zSurface->hasHiZ()); //the Z buffer is at least as large as the color surface
+
+		//4 horizontally adjacent pixels at a time: lane i is pixel x + i, and x is always a multiple of 4,
+		//so a group never straddles a HiZ block or a render tile. A group may stick out of the bounding
+		//box (but never out of the surface), so lanes are also masked against [minX, maxX].
+		const int lastGroupX = (int)colorSurface->getWidth() - 4;
+		const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 minX = _mm_set1_ps((float)setup.minX), maxX = _mm_set1_ps((float)setup.maxX);
+		const __m128 denom = _mm_set1_ps(setup.denom);
+		const __m128 e1dx = _mm_set1_ps(setup.e1dx), e2dx = _mm_set1_ps(setup.e2dx);
+		const __m128 e1dx4 = _mm_set1_ps(4 * setup.e1dx), e2dx4 = _mm_set1_ps(4 * setup.e2dx);
+
+		//attribute changes per pixel. Only the attributes the kernel actually shades with are evaluated:
+		//untextured pixels just need r, g, b and a, and a flat triangle's color never changes.
+		const AttributePlane* planes[] = { &setup.red, &setup.green, &setup.blue, &setup.alpha, &setup.s, &setup.t };
+		static const int ATTRIBUTE_COUNT = sizeof(planes) / sizeof(planes[0]);
+		static const int EVALUATED_COUNT = (FLAT ? 0 : TEXTURED ? ATTRIBUTE_COUNT : 4);
+		__m128 attributeDx[ATTRIBUTE_COUNT];
+		for (int i = 0; i < EVALUATED_COUNT; i++)
+			attributeDx[i] = _mm_set1_ps(planes[i]->dx);
+		const __m128 zdx = _mm_set1_ps(setup.z.dx);
+		const __m128 originX = _mm_set1_ps((float)setup.originX);
+
+		//unsigned 16 bit Z is packed with a signed saturating pack, so it is biased by 0x8000 around the pack
+		const __m128i zBias32 = _mm_set1_epi32(0x8000), zBias16 = _mm_set1_epi16((short)0x8000);
+
+		alignas(16) float lanesOf[ATTRIBUTE_COUNT][4];
+		alignas(16) uint8_t rgba[16];
+		if (FLAT) {
+			for (int i = 0; i < 4; i++) {
+				rgba[i] = (uint8_t)setup.red.v0; rgba[4 + i] = (uint8_t)setup.green.v0;
+				rgba[8 + i] = (uint8_t)setup.blue.v0; rgba[12 + i] = (uint8_t)setup.alpha.v0;
+			}
+		}
+
+		//large triangles are walked a block at a time: blocks that are outside of the triangle (or hidden) are
+		//skipped, and blocks that are entirely inside of it don't need their pixels tested against the edges.
+		//Small triangles go straight to the pixels; classifying their few blocks would cost more than it saves.
+		const bool coarse = (setup.maxX - setup.minX >= SMALL_TRIANGLE_SIZE || setup.maxY - setup.minY >= SMALL_TRIANGLE_SIZE);
+		const bool useBlocks = (coarse || hiZ);
+
+		//the BlockCoverage of every block in the current band of rows
+		static thread_local std::vector<uint8_t> blockCoverage;
+		const int firstBlock = setup.minX / (int)Surface::HIZ_BLOCK_SIZE;
+		if (useBlocks)
+			blockCoverage.resize(setup.maxX / Surface::HIZ_BLOCK_SIZE - firstBlock + 1);
+
+		//rows are handled in bands that line up with the blocks (which are the HiZ blocks)
+		for (int bandY = setup.minY; bandY <= setup.maxY; bandY = (bandY | (Surface::HIZ_BLOCK_SIZE - 1)) + 1) {
+			const int bandEnd = std::min(setup.maxY, bandY | (int)(Surface::HIZ_BLOCK_SIZE - 1));
+
+			//how far along the band's rows there is still anything to draw
+			int bandMaxX = setup.maxX;
+
+			if (useBlocks) {
+				//reject whole tiles first (cheap, and saves refreshing their blocks), then single blocks
+				bandMaxX = setup.minX - 1;
+				for (int tileX = setup.minX & ~(int)(Surface::HIZ_TILE_SIZE - 1); tileX <= setup.maxX; tileX += Surface::HIZ_TILE_SIZE) {
+					const int tileMinX = std::max(tileX, setup.minX), tileMaxX = std::min(tileX + (int)Surface::HIZ_TILE_SIZE - 1, setup.maxX);
+					const bool tileVisible = !hiZ || nearestZ(setup, tileMinX, bandY, tileMaxX, bandEnd) < zSurface->getTileMaxZ(tileX, bandY);
+
+					for (int blockX = tileMinX & ~(int)(Surface::HIZ_BLOCK_SIZE - 1); blockX <= tileMaxX; blockX += Surface::HIZ_BLOCK_SIZE) {
+						const int blockMinX = std::max(blockX, setup.minX), blockMaxX = std::min(blockX + (int)Surface::HIZ_BLOCK_SIZE - 1, setup.maxX);
+						BlockCoverage coverage = BLOCK_OUTSIDE;
+						if (tileVisible)
+							coverage = (coarse ? classifyBlock(setup, blockMinX, bandY, blockMaxX, bandEnd) : BLOCK_PARTIAL);
+						if (coverage != BLOCK_OUTSIDE && hiZ && nearestZ(setup, blockMinX, bandY, blockMaxX, bandEnd) >= zSurface->getBlockMaxZ(blockX, bandY))
+							coverage = BLOCK_OUTSIDE;
+
+						blockCoverage[blockX / Surface::HIZ_BLOCK_SIZE - firstBlock] = (uint8_t)coverage;
+						if (coverage != BLOCK_OUTSIDE)
+							bandMaxX = blockMaxX;
+					}
+				}
+				if (bandMaxX < setup.minX) { continue; } //nothing in the whole band
+			}
+
+			for (int y = bandY; y <= bandEnd; y++) {
+
+				uint8_t* colorRow = colorStart + y * colorPitch;
+				uint16_t* zRow = (Z_TEST ? reinterpret_cast<uint16_t*>(zStart + y * zPitch) : nullptr);
+
+				//edge values at the center of pixel (x, y); exact, because everything here is a multiple of .5
+				int x = setup.minX & ~3;
+				const float e1Start = setup.e1 + (x - setup.minX) * setup.e1dx + (y - setup.minY) * setup.e1dy;
+				const float e2Start = setup.e2 + (x - setup.minX) * setup.e2dx + (y - setup.minY) * setup.e2dy;
+				__m128 e1 = _mm_add_ps(_mm_set1_ps(e1Start), _mm_mul_ps(lanes, e1dx));
+				__m128 e2 = _mm_add_ps(_mm_set1_ps(e2Start), _mm_mul_ps(lanes, e2dx));
+
+				//Z, color and texture coordinates are evaluated straight from their planes, the same way
+				//AttributePlane::at() does: a pixel gets the same values whatever blocks or tiles the triangle
+				//is split into, and Z never drifts away from what hierarchical Z was checked against.
+				const int py = y - setup.originY;
+				__m128 rowStarts[ATTRIBUTE_COUNT];
+				for (int i = 0; i < EVALUATED_COUNT; i++)
+					rowStarts[i] = _mm_set1_ps(planes[i]->at(0, py));
+				const __m128 zRowStart = _mm_set1_ps(setup.z.at(0, py));
+
+				auto nextGroup = [&]() {
+					x += 4;
+					e1 = _mm_add_ps(e1, e1dx4); e2 = _mm_add_ps(e2, e2dx4);
+				};
+
+				for (; x <= bandMaxX && x <= lastGroupX; nextGroup()) {
+
+					uint8_t coverage = BLOCK_PARTIAL;
+					if (useBlocks) {
+						coverage = blockCoverage[x / Surface::HIZ_BLOCK_SIZE - firstBlock];
+						if (coverage == BLOCK_OUTSIDE) { continue; }
+					}
+
+					//coverage for all four pixels at once; only lanes past the bounding box can be outside of an inside block
+					const __m128 laneX = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+					__m128 inside = _mm_and_ps(_mm_cmpge_ps(laneX, minX), _mm_cmple_ps(laneX, maxX));
+					if (coverage == BLOCK_PARTIAL) {
+						const __m128 e3 = _mm_sub_ps(_mm_sub_ps(denom, e1), e2);
+						inside = _mm_and_ps(inside, _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)), _mm_cmpge_ps(e3, zero)));
+					}
+					int mask = _mm_movemask_ps(inside);
+					if (mask == 0) { continue; }
+
+					const __m128 px = _mm_sub_ps(laneX, originX);
+					if (Z_TEST) {
+						//masked Z test: only lanes that are inside and nearer survive
+						const __m128 Z = _mm_add_ps(zRowStart, _mm_mul_ps(px, zdx));
+						const __m128i oldZ = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(zRow + x)), _mm_setzero_si128());
+						inside = _mm_and_ps(inside, _mm_cmplt_ps(Z, _mm_cvtepi32_ps(oldZ)));
+						mask = _mm_movemask_ps(inside);
+						if (mask == 0) { continue; }
+
+						//masked Z write: failing lanes get their old value back
+						const __m128i keep = _mm_castps_si128(inside);
+						__m128i newZ = _mm_or_si128(_mm_and_si128(keep, _mm_cvttps_epi32(Z)), _mm_andnot_si128(keep, oldZ));
+						newZ = _mm_sub_epi32(newZ, zBias32);
+						newZ = _mm_xor_si128(_mm_packs_epi32(newZ, newZ), zBias16);
+						_mm_storel_epi64(reinterpret_cast<__m128i*>(zRow + x), newZ);
+						if (hiZ) { zSurface->markZWritten(x, y); }
+					}
+
+					uint8_t* loc = colorRow + x * colorBytes;
+					__m128 attributes[ATTRIBUTE_COUNT];
+					for (int i = 0; i < EVALUATED_COUNT; i++)
+						attributes[i] = _mm_add_ps(rowStarts[i], _mm_mul_ps(px, attributeDx[i]));
+
+					if (TEXTURED) {
+						//texel fetches can't be vectorized, so shade the surviving lanes one at a time
+						for (int i = 0; i < ATTRIBUTE_COUNT; i++)
+							_mm_store_ps(lanesOf[i], attributes[i]);
+						for (int i = 0; i < 4; i++, loc += colorBytes) {
+							if (!(mask & (1 << i))) { continue; }
+							const Color drawColor = shadePixel<TEXTURED, FILTER, WRAP, BLEND>(lanesOf[0][i], lanesOf[1][i], lanesOf[2][i], lanesOf[3][i], lanesOf[4][i], lanesOf[5][i]);
+							storeColor(loc, colorBytes, drawColor);
 						}
+						continue;
 					}
-					else { // this is the nearest mode
-						textureColor = getTexelbyWrapMode(m_textureMap, m_wrapMode, S, T);
+
+					//Gouraud color for all four pixels, truncated like the scalar conversion and packed to bytes: rrrr gggg bbbb aaaa
+					if (!FLAT) {
+						const __m128i red = _mm_cvttps_epi32(attributes[0]);
+						const __m128i green = _mm_cvttps_epi32(attributes[1]);
+						const __m128i blue = _mm_cvttps_epi32(attributes[2]);
+						const __m128i alpha = _mm_cvttps_epi32(attributes[3]);
+						_mm_store_si128(reinterpret_cast<__m128i*>(rgba), _mm_packus_epi16(_mm_packs_epi32(red, green), _mm_packs_epi32(blue, alpha)));
 					}
 
-					//blend mode starts here.
-					switch (m_blendMode) { //got tired of if statements lol
-					case TEXTURE_BLENDING_MODE_MODULATE:
-						drawColor.alpha = textureColor.alpha * drawColor.alpha / 255;
-						drawColor.red = textureColor.red * drawColor.red / 255;
-						drawColor.green = textureColor.green * drawColor.green / 255;
-						drawColor.blue = textureColor.blue * drawColor.blue / 255;
-						break;
-
-					case TEXTURE_BLENDING_MODE_DECAL:
-					default:
-						drawColor = textureColor;
-						}						
+					//masked color write. Four RGBA pixels are one 16 byte store: the channels are interleaved into
+					//rgba rgba rgba rgba, and lanes that failed get the old pixel back
+					if (colorBytes == 4) {
+						const __m128i planar = _mm_load_si128(reinterpret_cast<const __m128i*>(rgba));
+						const __m128i redBlue = _mm_unpacklo_epi8(planar, _mm_srli_si128(planar, 8));	// rb rb rb rb ga ga ga ga
+						const __m128i pixels = _mm_unpacklo_epi8(redBlue, _mm_srli_si128(redBlue, 8));
+						const __m128i old = _mm_loadu_si128(reinterpret_cast<const __m128i*>(loc));
+						const __m128i keep = _mm_castps_si128(inside);
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(loc), _mm_or_si128(_mm_and_si128(keep, pixels), _mm_andnot_si128(keep, old)));
+						continue;
 					}
-				drawingSurface->drawPixel(x, y, drawColor);
+					for (int i = 0; i < 4; i++, loc += colorBytes) {
+						if (!(mask & (1 << i))) { continue; }
+						loc[0] = rgba[i]; loc[1] = rgba[4 + i]; loc[2] = rgba[8 + i];
+					}
+				}
+
+				//pixels in the last (partial) group of the surface's row
+				x = std::max(x, setup.minX);
+				float e1Tail = setup.e1 + (x - setup.minX) * setup.e1dx + (y - setup.minY) * setup.e1dy;
+				float e2Tail = setup.e2 + (x - setup.minX) * setup.e2dx + (y - setup.minY) * setup.e2dy;
+				for (; x <= bandMaxX; x++, e1Tail += setup.e1dx, e2Tail += setup.e2dx) {
+					const float e3 = setup.denom - e1Tail - e2Tail;
+					if (e1Tail < 0 || e2Tail < 0 || e3 < 0) { continue; }
+
+					const int px = x - setup.originX;
+					if (Z_TEST) {
+						const float Z = setup.z.at(px, py);
+						if (Z >= zRow[x]) { continue; }
+						zRow[x] = (uint16_t)std::min(std::max(Z, 0.0f), 65535.0f);
+						if (hiZ) { zSurface->markZWritten(x, y); }
+					}
+
+					const Color drawColor = shadePixel<TEXTURED, FILTER, WRAP, BLEND>(setup.red.at(px, py), setup.green.at(px, py), setup.blue.at(px, py),
+						setup.alpha.at(px, py), setup.s.at(px, py), setup.t.at(px, py));
+					storeColor(colorRow + x * colorBytes, colorBytes, drawColor);
+				}
+			}
+		}
+	}
+
+	void DrawingContext::fillFlatTriangle(Surface * colorSurface, const TriangleSetup & setup) const {
+
+		uint8_t* colorStart = static_cast<uint8_t*>(colorSurface->getStart());
+		const uint32_t colorPitch = colorSurface->getPitch();
+		const uint32_t colorBytes = (colorSurface->getFormat() == PF_RGBA_8888 ? 4 : 3);
+		Color color((uint8_t)setup.red.v0, (uint8_t)setup.green.v0, (uint8_t)setup.blue.v0);
+		color.alpha = (uint8_t)setup.alpha.v0;
+		const float e3dx = -setup.e1dx - setup.e2dx;
+
+		//narrows [first, last] (pixels from minX) down to where e + i * dx >= 0. That value is exact for whole i,
+		//so the division only gives a first guess, which is then nudged onto the same boundary the other kernels see.
+		auto narrow = [](float e, float dx, int& first, int& last) {
+			if (dx > 0) {
+				int i = (int)std::ceil(-e / dx);
+				while (e + (i - 1) * dx >= 0) { i--; }
+				while (e + i * dx < 0) { i++; }
+				first = std::max(first, i);
 			}
+			else if (dx < 0) {
+				int i = (int)std::floor(e / -dx);
+				while (e + (i + 1) * dx >= 0) { i++; }
+				while (e + i * dx < 0) { i--; }
+				last = std::min(last, i);
+			}
+			else if (e < 0)
+				last = first - 1;
+		};
+
+		for (int y = setup.minY; y <= setup.maxY; y++) {
+
+			//a triangle covers a single run of pixels in every row
+			const int py = y - setup.minY;
+			const float e1 = setup.e1 + py * setup.e1dy, e2 = setup.e2 + py * setup.e2dy;
+			int first = 0, last = setup.maxX - setup.minX;
+			narrow(e1, setup.e1dx, first, last);
+			narrow(e2, setup.e2dx, first, last);
+			narrow(setup.denom - e1 - e2, e3dx, first, last);
+
+			uint8_t* loc = colorStart + y * colorPitch + (setup.minX + first) * colorBytes;
+			for (int i = first; i <= last; i++, loc += colorBytes)
+				storeColor(loc, colorBytes, color);
 		}
 	}
+#endif
+
+	void DrawingContext::blendRow(ISurface * drawingSurface, int y, const BlendRow & row) const {
+
+		if (row.first > row.last)
+			return;
+		const int count = row.last - row.first + 1;
+		const Color* src = row.colors.data() + (row.first - row.minX);
+		const uint8_t* covered = row.covered.data() + (row.first - row.minX);
+
+		//RGBA surface memory is blended in place. Anything else is read into a row of Colors, which have the same
+		//layout, blended there and written back; pixels that weren't covered go back the way they came.
+		Surface* colorSurface = rowOrderSurface(drawingSurface);
+		const bool inPlace = (colorSurface != nullptr && colorSurface->getFormat() == PF_RGBA_8888);
+		uint8_t* dst;
+		static thread_local std::vector<Color> readBack;
+		if (inPlace)
+			dst = static_cast<uint8_t*>(colorSurface->getStart()) + y * colorSurface->getPitch() + row.first * 4;
+		else {
+			if (readBack.size() < (size_t)count) { readBack.resize(count); }
+			drawingSurface->readSpan(row.first, y, count, readBack.data());
+			dst = reinterpret_cast<uint8_t*>(readBack.data());
+		}
 
-	Color DrawingContext::getTexelbyWrapMode(ISurface * textureMap, TextureWrappingMode wrapMode, float s, float t) const {
+		switch (m_pipeline.blendFunction) {
+		case BLEND_FUNCTION_SOURCE_OVER:
+			blendSpan<BLEND_FUNCTION_SOURCE_OVER>(src, covered, dst, count);
+			break;
+		case BLEND_FUNCTION_ADDITIVE:
+			blendSpan<BLEND_FUNCTION_ADDITIVE>(src, covered, dst, count);
+			break;
+		case BLEND_FUNCTION_NONE:
+		default:
+			blendSpan<BLEND_FUNCTION_NONE>(src, covered, dst, count);
+		}
+
+		if (!inPlace)
+			drawingSurface->drawSpan(row.first, y, count, readBack.data());
+	}
 
-		float width = m_textureMap->getWidth(); float height = m_textureMap->getHeight();
+	template <bool TEXTURED, TextureFilteringMode FILTER, TextureWrappingMode WRAP, TextureBlendingMode BLEND>
+	Color DrawingContext::shadePixel(float red, float green, float blue, float alpha, float S, float T) const {
+
+		Color drawColor;
+
+		//interpolated color, already scaled to 0-255
+		drawColor.red = red;
+		drawColor.green = green;
+		drawColor.blue = blue;
+		drawColor.alpha = alpha;
+
+		if (TEXTURED) { // This will get your texture calculations
+
+			const Color textureColor = sampleTexture<FILTER, WRAP>(S, T);
+
+			//blend mode starts here.
+			switch (BLEND) { //got tired of if statements lol
+			case TEXTURE_BLENDING_MODE_MODULATE:
+				drawColor.alpha = textureColor.alpha * drawColor.alpha / 255;
+				drawColor.red = textureColor.red * drawColor.red / 255;
+				drawColor.green = textureColor.green * drawColor.green / 255;
+				drawColor.blue = textureColor.blue * drawColor.blue / 255;
+				break;
+
+			case TEXTURE_BLENDING_MODE_DECAL:
+			default:
+				drawColor = textureColor;
+			}
+		}
+
+		return drawColor;
+	}
+
+	template <TextureFilteringMode FILTER, TextureWrappingMode WRAP>
+	Color DrawingContext::sampleTexture(float S, float T) const {
+
+		ISurface* textureMap = m_pipeline.textureMap;
+		Color textureColor;
+
+		// This is the filter mode
+		if (FILTER == TEXTURE_FILTERING_MODE_BILINEAR) {
+
+			//this sets up values
+			float dx = S - floor(S) - .5; float dy = T - floor(T) - .5;
+			//dist from pix center
+			float adx = fabs(dx); float ady = fabs(dy);
+			float diffx = adx * (1 - ady); //for use in calculations
+			float diffy = (1 - adx) * ady;
+			float diffxy = adx * ady;
+			float identical = (1 - adx) * (1 - ady);
+
+			Color TL, TR, BL, BR; //color objects for top left, top right, bottom left, and bottom right texels
+			//bulk of code starts here
+			if (dy >= 0 && dx >= 0) { // TOP LEFT IS CURRENT TEXEL
+									  // we set the colors to the appropriate pixels using the wrap mode method so that we can determine the correct pixel regardless of wrap mode
+				TL = getTexelbyWrapMode<WRAP>(textureMap, S, T); TR = getTexelbyWrapMode<WRAP>(textureMap, S + 1, T); 
+				BL = getTexelbyWrapMode<WRAP>(textureMap, S, T + 1);  BR = getTexelbyWrapMode<WRAP>(textureMap, S + 1, T + 1); 
+				
+				//calculate the colors based on the formula
+				textureColor.alpha = TL.alpha	* identical + TR.alpha	* diffx + BL.alpha	* diffy + BR.alpha	* diffxy;
+				textureColor.red = TL.red	* identical + TR.red		* diffx + BL.red	* diffy + BR.red	* diffxy;
+				textureColor.green = TL.green	* identical + TR.green	* diffx + BL.green	* diffy + BR.green	* diffxy;
+				textureColor.blue = TL.blue	* identical + TR.blue	* diffx + BL.blue	* diffy + BR.blue	* diffxy;
+			}
+			else if (dy >= 0 && dx < 0) { //if this code runs then the top right is the current texel
+				TL = getTexelbyWrapMode<WRAP>(textureMap, S - 1, T); TR = getTexelbyWrapMode<WRAP>(textureMap, S, T);
+				BL = getTexelbyWrapMode<WRAP>(textureMap, S - 1, T + 1); BR = getTexelbyWrapMode<WRAP>(textureMap, S, T + 1);
+
+				textureColor.alpha = TL.alpha	* diffx + TR.alpha	* identical + BL.alpha	* diffxy + BR.alpha	* diffy;
+				textureColor.red = TL.red	* diffx + TR.red	* identical + BL.red		* diffxy + BR.red	* diffy;
+				textureColor.green = TL.green	* diffx + TR.green	* identical + BL.green	* diffxy + BR.green	* diffy;
+				textureColor.blue = TL.blue	* diffx + TR.blue	* identical + BL.blue	* diffxy + BR.blue	* diffy;
+			}
+			else if (dy < 0 && dx >= 0) { // if this code runs then bottom left is the current texel
+				TL = getTexelbyWrapMode<WRAP>(textureMap, S, T - 1); TR = getTexelbyWrapMode<WRAP>(textureMap, S + 1, T - 1);
+				BL = getTexelbyWrapMode<WRAP>(textureMap, S, T); BR = getTexelbyWrapMode<WRAP>(textureMap, S + 1, T);
+
+				textureColor.alpha = TL.alpha	* diffy + TR.alpha	* diffxy + BL.alpha	* identical + BR.alpha	* diffx;
+				textureColor.red = TL.red	* diffy + TR.red	* diffxy + BL.red	* identical + BR.red		* diffx;
+				textureColor.green = TL.green	* diffy + TR.green	* diffxy + BL.green	* identical + BR.green	* diffx;
+				textureColor.blue = TL.blue	* diffy + TR.blue	* diffxy + BL.blue	* identical + BR.blue	* diffx;
+			}
+			else if (dx < 0 && dy < 0) { // if this code runs then bottom right is the current texel.
+				TL = getTexelbyWrapMode<WRAP>(textureMap, S - 1, T - 1);
+				TR = getTexelbyWrapMode<WRAP>(textureMap, S, T - 1);
+				BL = getTexelbyWrapMode<WRAP>(textureMap, S - 1, T);
+				BR = getTexelbyWrapMode<WRAP>(textureMap, S, T);
+
+				//color starts here
+				textureColor.alpha = TL.alpha	* diffxy + TR.alpha	* diffy + BL.alpha	* diffx + BR.alpha	* identical;
+				textureColor.red = TL.red	* diffxy + TR.red	* diffy + BL.red	* diffx + BR.red	* identical;
+				textureColor.green = TL.green	* diffxy + TR.green	* diffy + BL.green	* diffx + BR.green	* identical;
+				textureColor.blue = TL.blue	* diffxy + TR.blue	* diffy + BL.blue	* diffx + BR.blue	* identical;
+			}
+		}
+		else { // this is the nearest mode
+			textureColor = getTexelbyWrapMode<WRAP>(textureMap, S, T);
+		}
+
+		return textureColor;
+	}
+
+	template <TextureWrappingMode WRAP>
+	Color DrawingContext::getTexelbyWrapMode(ISurface * textureMap, float s, float t) const {
+
+		float width = textureMap->getWidth(); float height = textureMap->getHeight();
 		float S = s; float T = t;
 
-		if (wrapMode == TEXTURE_WRAPPING_MODE_MIRROR) {
+		if (WRAP == TEXTURE_WRAPPING_MODE_MIRROR) {
 			S = fabs(S); T = fabs(T);
 			S = fmod(S, 2 * width); T = fmod(T, 2 * height);
 			if (S > width) { S = width - (S - width); } if (T > height) { T = height - (T - height); }
@@ -284,7 +1735,7 @@ namespace ctxgraf {
 		} if (T == height) { T = 0; }
 			//mod by 2 then if greater than 1 width,  calculate reverse s and t vals. if equal to width or height, set 0.
 		}
-		else if (wrapMode == TEXTURE_WRAPPING_MODE_REPEAT) {
+		else if (WRAP == TEXTURE_WRAPPING_MODE_REPEAT) {
 			while (S < 0) { S += width; } while (T < 0) { T += height; }
 			S = fmod(S, width); T = fmod(T, height);
 			//if we do not move it to positive coords (instead of modding), it will get flipped.
@@ -292,6 +1743,10 @@ namespace ctxgraf {
 		else { // clamp mode is default
 			S = std::max(std::min(S, width - 1), 0.f); T = std::max(std::min(T, height - 1), 0.f);
 		}
+
+		//straight from texture memory when it's a Surface, which is usually the case
+		if (m_pipeline.textureSurface != nullptr && S >= 0 && T >= 0 && S < width && T < height)
+			return m_pipeline.textureSurface->readPixel((uint32_t)S, (uint32_t)T);
 		return textureMap->getPixel(S, T);
 	}
 
@@ -311,12 +1766,85 @@ namespace ctxgraf {
 		color.alpha += slope.alpha;
 	}
 
-	void DrawingContext::setTextureMap(ISurface * textureSurface) {	m_textureMap = textureSurface;}
+	void DrawingContext::updatePipelineState() {
+
+		PipelineState pipeline;
+		pipeline.textureMap = m_textureMap;
+		pipeline.textureSurface = dynamic_cast<const Surface*>(m_textureMap);
+		pipeline.filterMode = m_filterMode;
+		pipeline.wrapMode = m_wrapMode;
+		pipeline.blendMode = m_blendMode;
+		pipeline.blendFunction = m_blendFunction;
+		pipeline.alphaTestThreshold = m_alphaTestThreshold;
+		pipeline.blended = (m_blendFunction != BLEND_FUNCTION_NONE || m_alphaTestThreshold > 0);
+
+		//without a texture map the other settings don't change anything, so they all share one set of kernels
+		if (m_textureMap == nullptr)
+			setKernels<false, TEXTURE_FILTERING_MODE_NEAREST, TEXTURE_WRAPPING_MODE_CLAMP, TEXTURE_BLENDING_MODE_DECAL>(pipeline);
+		else if (m_filterMode == TEXTURE_FILTERING_MODE_BILINEAR)
+			setFilteredKernels<TEXTURE_FILTERING_MODE_BILINEAR>(pipeline);
+		else
+			setFilteredKernels<TEXTURE_FILTERING_MODE_NEAREST>(pipeline);
+
+		m_pipeline = pipeline;
+	}
+
+	template <TextureFilteringMode FILTER>
+	void DrawingContext::setFilteredKernels(PipelineState & pipeline) const {
+		switch (pipeline.wrapMode) {
+		case TEXTURE_WRAPPING_MODE_MIRROR:
+			setWrappedKernels<FILTER, TEXTURE_WRAPPING_MODE_MIRROR>(pipeline);
+			break;
+		case TEXTURE_WRAPPING_MODE_REPEAT:
+			setWrappedKernels<FILTER, TEXTURE_WRAPPING_MODE_REPEAT>(pipeline);
+			break;
+		case TEXTURE_WRAPPING_MODE_CLAMP:
+		default:
+			setWrappedKernels<FILTER, TEXTURE_WRAPPING_MODE_CLAMP>(pipeline);
+		}
+	}
+
+	template <TextureFilteringMode FILTER, TextureWrappingMode WRAP>
+	void DrawingContext::setWrappedKernels(PipelineState & pipeline) const {
+		switch (pipeline.blendMode) {
+		case TEXTURE_BLENDING_MODE_MODULATE:
+			setKernels<true, FILTER, WRAP, TEXTURE_BLENDING_MODE_MODULATE>(pipeline);
+			break;
+		case TEXTURE_BLENDING_MODE_DECAL:
+		default:
+			setKernels<true, FILTER, WRAP, TEXTURE_BLENDING_MODE_DECAL>(pipeline);
+		}
+	}
+
+	template <bool TEXTURED, TextureFilteringMode FILTER, TextureWrappingMode WRAP, TextureBlendingMode BLEND>
+	void DrawingContext::setKernels(PipelineState & pipeline) const {
+		pipeline.genericKernels[0] = &DrawingContext::rasterizeTriangleGeneric<false, false, TEXTURED, FILTER, WRAP, BLEND>;
+		pipeline.genericKernels[1] = &DrawingContext::rasterizeTriangleGeneric<true, false, TEXTURED, FILTER, WRAP, BLEND>;
+		pipeline.fixedKernels[0] = &DrawingContext::rasterizeTriangleFixed<false, false, TEXTURED, FILTER, WRAP, BLEND>;
+		pipeline.fixedKernels[1] = &DrawingContext::rasterizeTriangleFixed<true, false, TEXTURED, FILTER, WRAP, BLEND>;
+		pipeline.blendedKernels[0][0] = &DrawingContext::rasterizeTriangleGeneric<false, true, TEXTURED, FILTER, WRAP, BLEND>;
+		pipeline.blendedKernels[0][1] = &DrawingContext::rasterizeTriangleGeneric<true, true, TEXTURED, FILTER, WRAP, BLEND>;
+		pipeline.blendedKernels[1][0] = &DrawingContext::rasterizeTriangleFixed<false, true, TEXTURED, FILTER, WRAP, BLEND>;
+		pipeline.blendedKernels[1][1] = &DrawingContext::rasterizeTriangleFixed<true, true, TEXTURED, FILTER, WRAP, BLEND>;
+#ifdef CTXGRAF_SSE2
+		//a texture makes every pixel different anyway, so textured kernels ignore flat color
+		pipeline.surfaceKernels[0][0] = &DrawingContext::rasterizeTriangleSSE2<false, false, TEXTURED, FILTER, WRAP, BLEND>;
+		pipeline.surfaceKernels[0][1] = &DrawingContext::rasterizeTriangleSSE2<false, !TEXTURED, TEXTURED, FILTER, WRAP, BLEND>;
+		pipeline.surfaceKernels[1][0] = &DrawingContext::rasterizeTriangleSSE2<true, false, TEXTURED, FILTER, WRAP, BLEND>;
+		pipeline.surfaceKernels[1][1] = &DrawingContext::rasterizeTriangleSSE2<true, !TEXTURED, TEXTURED, FILTER, WRAP, BLEND>;
+#endif
+	}
+
+	void DrawingContext::setTextureMap(ISurface * textureSurface) {
+		m_textureMap = textureSurface;
+		updatePipelineState();
+	}
 
 	void DrawingContext::setTextureWrappingMode(TextureWrappingMode wrapMode) {
 		if (wrapMode >= TEXTURE_WRAPPING_MODE_COUNT) //if the wrap mode is greater than or equal to TEXTURE_WRAPPING_MODE_COUNT throw param exception.
 			throw ParameterException("invalid wrap mode");
 		m_wrapMode = wrapMode;
+		updatePipelineState();
 	}
 
 	TextureWrappingMode DrawingContext::getTextureWrappingMode() const {return m_wrapMode;}
@@ -326,6 +1854,7 @@ namespace ctxgraf {
 		if (blendMode >= TEXTURE_BLENDING_MODE_COUNT) //same as wrapMode
 			throw ParameterException("invalid blend mode");
 		m_blendMode = blendMode;
+		updatePipelineState();
 	}
 
 	TextureBlendingMode DrawingContext::getTextureBlendingMode() const { return m_blendMode; }
@@ -339,8 +1868,83 @@ namespace ctxgraf {
 				throw ParameterException("invalid filter mode");
 
 			m_filterMode = filterMode;
+			updatePipelineState();
 		}
 
+	void DrawingContext::setBlendFunction(BlendFunction function) {
+		if (function >= BLEND_FUNCTION_COUNT)
+			throw ParameterException("invalid blend function");
+		m_blendFunction = function;
+		updatePipelineState();
+	}
+
+	BlendFunction DrawingContext::getBlendFunction() const { return m_blendFunction; }
+
+	void DrawingContext::setAlphaTestThreshold(uint8_t threshold) {
+		m_alphaTestThreshold = threshold;
+		updatePipelineState();
+	}
+
+	uint8_t DrawingContext::getAlphaTestThreshold() const { return m_alphaTestThreshold; }
+
+	void DrawingContext::setRenderMode(RenderMode mode) {
+		if (mode >= RENDER_MODE_COUNT) //same as wrapMode
+			throw ParameterException("invalid render mode");
+		m_renderMode = mode;
+	}
+
+	RenderMode DrawingContext::getRenderMode() const { return m_renderMode; }
+
+	void DrawingContext::setRasterMode(RasterMode mode) {
+		if (mode >= RASTER_MODE_COUNT)
+			throw ParameterException("invalid raster mode");
+		m_rasterMode = mode;
+	}
+
+	RasterMode DrawingContext::getRasterMode() const { return m_rasterMode; }
+
+	void DrawingContext::setCullMode(CullMode mode) {
+		if (mode >= CULL_MODE_COUNT)
+			throw ParameterException("invalid cull mode");
+		m_cullMode = mode;
+	}
+
+	CullMode DrawingContext::getCullMode() const { return m_cullMode; }
+
+	void DrawingContext::setFrontFace(FrontFace frontFace) {
+		if (frontFace >= FRONT_FACE_COUNT)
+			throw ParameterException("invalid front face");
+		m_frontFace = frontFace;
+	}
+
+	FrontFace DrawingContext::getFrontFace() const { return m_frontFace; }
+
+	void DrawingContext::setViewport(const Rect * viewport) {
+		if (viewport != nullptr && (viewport->width == 0 || viewport->height == 0))
+			throw ParameterException("empty viewport");
+		m_hasViewport = (viewport != nullptr);
+		if (m_hasViewport)
+			m_viewport = *viewport;
+	}
+
+	bool DrawingContext::getViewport(Rect & viewport) const {
+		if (m_hasViewport)
+			viewport = m_viewport;
+		return m_hasViewport;
+	}
+
+	void DrawingContext::setScissor(const Rect * scissor) {
+		m_hasScissor = (scissor != nullptr);
+		if (m_hasScissor)
+			m_scissor = *scissor;
+	}
+
+	bool DrawingContext::getScissor(Rect & scissor) const {
+		if (m_hasScissor)
+			scissor = m_scissor;
+		return m_hasScissor;
+	}
+
 	void DrawingContext::setLineColor(VertexColor lineColor) {
 		m_lineColor = lineColor;
 	}
@@ -2,9 +2,191 @@
 #pragma once
 
 #include "ctxgraf_pub.h"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//SSE2 is always there on x64, and on x86 whenever the compiler is allowed to use it
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define CTXGRAF_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace ctxgraf {
 
+	class Surface;
+
+	//screen tiles used by RENDER_MODE_TILED are this many pixels on a side
+	static const int RENDER_TILE_SIZE = 64;
+
+	//triangles whose bounding box is smaller than this many pixels both ways skip block classification
+	static const int SMALL_TRIANGLE_SIZE = 16;
+
+	//how a block of pixels lies with respect to a triangle's edges
+	enum BlockCoverage {
+		BLOCK_OUTSIDE,
+		BLOCK_PARTIAL,
+		BLOCK_INSIDE,
+	};
+
+	//constant-color polylines with more than this many vertices per pixel column of the clip rectangle get decimated first;
+	//smooth-shaded ones never are, since dropping a vertex would drop its color too
+	static const uint32_t DECIMATION_VERTICES_PER_COLUMN = 8;
+
+	//batches of triangles are set up about this many at a time
+	static const uint32_t SETUP_BATCH_SIZE = 32;
+
+	//number of transformed vertices drawIndexed() remembers
+	static const uint32_t VERTEX_CACHE_SIZE = 32;
+
+	//triangles that stay within this many pixels of the viewport are rasterized without being clipped.
+	//It keeps vertex coordinates small enough for the float edge functions to stay exact.
+	static const int GUARD_BAND = 512;
+
+	//clipping a triangle against the four guard band edges leaves at most a 7-sided polygon
+	static const uint32_t MAX_CLIPPED_TRIANGLES = 5;
+
+	/**
+	* The guard band in vertex coordinates (the viewport is [-1, 1] in both directions).
+	*/
+	struct GuardBand {
+		float minX, maxX, minY, maxY;
+
+		bool contains(const Vertex& vertex) const { return vertex.x >= minX && vertex.x <= maxX && vertex.y >= minY && vertex.y <= maxY; }
+	};
+
+	/**
+	* A value that varies linearly over a triangle (Z, a color channel, a texture coordinate), kept as a
+	* plane over the screen so that moving one pixel over only takes one add.
+	*/
+	struct AttributePlane {
+		float v0;					// value at the center of pixel (originX, originY) of the setup it belongs to
+		float dx, dy;				// change per pixel step in x and y
+
+		//value at the center of the pixel that is (x, y) pixels away from (originX, originY). The row part goes
+		//in first, so at(0, y) + x * dx comes out exactly the same.
+		float at(int x, int y) const { return (v0 + y * dy) + x * dx; }
+	};
+
+	/**
+	* An AttributePlane in 16.16 fixed point. Integer steps add up to the same value whichever way
+	* a pixel is reached, so RASTER_MODE_SUBPIXEL output doesn't depend on how a triangle is split up.
+	*/
+	struct FixedPlane {
+		int64_t v0;
+		int64_t dx, dy;
+
+		int64_t at(int x, int y) const { return v0 + x * dx + y * dy; }
+	};
+
+	/**
+	* Everything the rasterizer needs for one triangle, computed once before any pixel is touched.
+	* Edge functions are kept unnormalized: vertices are snapped to whole pixels and samples are taken
+	* at pixel centers, so edge values are exact multiples of .5 and can be stepped by adding deltas
+	* without drifting. Barycentric weights are the edge values times invDenom.
+	*/
+	struct TriangleSetup {
+		Vertex v1, v2, v3;			// vertices in surface coordinates (z in [0,65535], s/t in texels)
+		float e1dx, e1dy;			// change in edge function 1 (opposite v1) per pixel step in x and y
+		float e2dx, e2dy;			// change in edge function 2 (opposite v2) per pixel step in x and y
+		float e1, e2;				// edge function values at the center of pixel (minX, minY)
+		float denom;				// twice the signed area, sign-adjusted so that covered pixels have e >= 0
+		float invDenom;				// reciprocal of denom
+		int minX, maxX, minY, maxY;	// pixel bounding box, clamped to the surface
+		int originX, originY;		// pixel the float attribute planes are anchored at; (minX, minY) until the setup is clipped
+		AttributePlane z;			// Z buffer value
+		AttributePlane red, green, blue, alpha;	// Gouraud color, already scaled to 0-255
+		AttributePlane s, t;		// texture coordinates in texels
+		float zMin;					// nearest vertex Z; no pixel of the triangle is nearer than this
+		float zMargin;				// how far the plane can be off from the per-pixel Z because of rounding
+		bool flatColor;				// all three vertices have the same color, so the color planes are constant
+
+		//RASTER_MODE_SUBPIXEL only: vertices are in 28.4 fixed point, so the edge functions are whole numbers
+		//of 1/256 pixel^2. The top-left fill rule is folded in by subtracting one from edges that aren't top
+		//or left edges, which keeps the inside test at e >= 0.
+		bool fixedPoint;
+		int64_t fe1dx, fe1dy, fe2dx, fe2dy;	// change in the edge functions per pixel step
+		int64_t fe1, fe2;			// biased edge functions at the center of pixel (minX, minY)
+		int64_t fdenom;				// twice the area, with all three edge biases added in (e3 = fdenom - e1 - e2)
+		FixedPlane fz, fred, fgreen, fblue, falpha, fs, ft;	// the attribute planes above, in 16.16
+	};
+
+	/**
+	* A line segment ready to rasterize: endpoints in 28.4 fixed point surface coordinates.
+	*/
+	struct LineSetup {
+		int64_t XA, YA, XB, YB;
+		VertexColor colorA, colorB;
+	};
+
+	/**
+	* One thread's private color and Z targets in RENDER_MODE_SORT_LAST.
+	*/
+	struct SortLastTarget {
+		std::unique_ptr<ISurface> color;
+		std::unique_ptr<IZBuffer> zBuffer;
+		int minX, maxX, minY, maxY;	// pixels the thread's triangles can have touched in the current batch
+	};
+
+	/**
+	* One row of shaded triangle pixels that passed all of the tests, collected so that they can be blended
+	* into the drawing surface together. Pixels are kept in surface order, so the row can be blended as a span.
+	*/
+	struct BlendRow {
+		std::vector<Color> colors;		// pixel x is colors[x - minX]
+		std::vector<uint8_t> covered;	// 0xFF where colors has a pixel to blend, 0 elsewhere
+		int minX;
+		int first, last;				// the covered pixels are all in [first, last]
+
+		//starts a row of the triangle whose bounding box goes from minX to maxX
+		void start(int minX, int maxX) {
+			const size_t width = maxX - minX + 1;
+			if (colors.size() < width) { colors.resize(width); }
+			covered.assign(width, 0);
+			this->minX = minX;
+			first = maxX + 1; last = minX - 1;
+		}
+
+		void add(int x, const Color& color) {
+			colors[x - minX] = color;
+			covered[x - minX] = 0xFF;
+			first = std::min(first, x); last = std::max(last, x);
+		}
+	};
+
+	class DrawingContext;
+
+	//triangle rasterizers, each one compiled for a single combination of pipeline state
+	typedef void (DrawingContext::*TriangleKernel)(ISurface* drawingSurface, IZBuffer* zBuffer, const TriangleSetup& setup) const;
+#ifdef CTXGRAF_SSE2
+	typedef void (DrawingContext::*SurfaceTriangleKernel)(Surface* colorSurface, Surface* zSurface, const TriangleSetup& setup) const;
+#endif
+
+	/**
+	* The state that decides how a covered pixel is shaded, bundled together with the rasterizers that were
+	* specialized for it at compile time. It is never changed, only replaced: a new one is made whenever one
+	* of the texture, blending or alpha test settings changes, so the pixel loops don't have to look at any of them.
+	* The kernel arrays are indexed by whether there is a Z buffer.
+	*/
+	struct PipelineState {
+		ISurface* textureMap;				// null for no texturing
+		const Surface* textureSurface;		// textureMap, if texels can be read without the virtual calls
+		TextureFilteringMode filterMode;
+		TextureWrappingMode wrapMode;
+		TextureBlendingMode blendMode;
+		BlendFunction blendFunction;
+		uint8_t alphaTestThreshold;
+		bool blended;						// a blend function or the alpha test is on, so only the blended kernels will do
+		TriangleKernel genericKernels[2];	// RASTER_MODE_PIXEL, drawing through the surface interfaces
+		TriangleKernel fixedKernels[2];		// RASTER_MODE_SUBPIXEL
+		TriangleKernel blendedKernels[2][2];	// either raster mode, with blending; first index is TriangleSetup::fixedPoint
+#ifdef CTXGRAF_SSE2
+		SurfaceTriangleKernel surfaceKernels[2][2];	// RASTER_MODE_PIXEL into Surface memory; second index is TriangleSetup::flatColor
+#endif
+	};
+
 	class DrawingContext : public IDrawingContext {
 	
 	private:
@@ -14,7 +196,23 @@ namespace ctxgraf {
 		//virtual void DrawFlatBottomTriangle(const Vertex& v1, const Vertex& v2, const Vertex& v3, Color c);
 
 	public:
-		DrawingContext() {}
+		DrawingContext()
+			: m_lineShadingMode(LINE_SHADING_MODE_CONSTANT)
+			, m_textureMap(nullptr)
+			, m_wrapMode(TEXTURE_WRAPPING_MODE_CLAMP)
+			, m_blendMode(TEXTURE_BLENDING_MODE_DECAL)
+			, m_filterMode(TEXTURE_FILTERING_MODE_NEAREST)
+			, m_renderMode(RENDER_MODE_IMMEDIATE)
+			, m_rasterMode(RASTER_MODE_PIXEL)
+			, m_cullMode(CULL_NONE)
+			, m_frontFace(FRONT_FACE_COUNTER_CLOCKWISE)
+			, m_blendFunction(BLEND_FUNCTION_NONE)
+			, m_alphaTestThreshold(0)
+			, m_hasViewport(false)
+			, m_hasScissor(false)
+		{
+			updatePipelineState();
+		}
 		~DrawingContext() {}
 		/**
 		* Draw a series of line segments that connect every adjacent pair of vertices.
@@ -25,10 +223,32 @@ namespace ctxgraf {
 		* @param[in] vertices The array of vertices in the polyline.
 		* @param[in] vertexCount The number of vertices in the array.
 		*
+		* With LINE_SHADING_MODE_CONSTANT, a polyline with many more vertices than the clip rectangle
+		* has pixel columns is first decimated to the vertices that change which pixels are covered.
+		* With LINE_SHADING_MODE_SMOOTH every vertex is drawn, so that no vertex color is lost.
+		*
 		* @throws ParameterException if vertices is NULL, or vertexCount < 2.
 		*/
 		virtual void polyline(ISurface* drawingSurface, const Vertex* vertices, uint32_t vertexCount) const;
 
+		/**
+		* Draw a batch of independent polylines.
+		* Polyline i uses vertices[offsets[i]] up to but not including vertices[offsets[i+1]],
+		* so offsets has polylineCount + 1 entries. Polylines with fewer than 2 vertices draw nothing.
+		* The result is the same as calling polyline() for each polyline in order, but the
+		* segments are drawn in parallel, each thread owning a band of surface rows.
+		* Long polylines are decimated under the same shading mode rule as in polyline().
+		*
+		* @param[in] drawingSurface The surface to draw into.
+		* @param[in] vertices The array of vertices. Every offset must be a valid position in it, or its end.
+		* @param[in] offsets The array of polylineCount + 1 vertex offsets, in increasing order.
+		* @param[in] polylineCount The number of polylines in the batch.
+		*
+		* @throws ParameterException if drawingSurface, vertices or offsets is NULL,
+		* or the offsets decrease.
+		*/
+		virtual void polylines(ISurface* drawingSurface, const Vertex* vertices, const uint32_t* offsets, uint32_t polylineCount) const;
+
 		/**
 		* Set the constant line color.
 		* This color is used for all lines if LINE_SHADING_MODE_CONSTANT is being used.
@@ -70,7 +290,153 @@ namespace ctxgraf {
 		*/
 		virtual void triangle(ISurface* drawingSurface, IZBuffer* zBuffer, const Vertex* v1, const Vertex* v2, const Vertex* v3) const;
 
-		Color getTexelbyWrapMode(ISurface * textureMap, TextureWrappingMode wrapMode, float s, float t) const;
+		/**
+		* Draw a batch of independent triangles.
+		* Triangle i uses vertices[3*i], vertices[3*i+1] and vertices[3*i+2].
+		* The result is the same as calling triangle() for each triangle in order;
+		* the render mode decides how the work is actually done.
+		*
+		* @param[in] drawingSurface The surface to draw into.
+		* @param[in] zBuffer The Z buffer to use. (May be null for no Z buffering)
+		* @param[in] vertices The array of 3 * triangleCount vertices.
+		* @param[in] triangleCount The number of triangles in the batch.
+		*
+		* @throws ParameterException if drawingSurface or vertices is NULL.
+		*/
+		virtual void triangleList(ISurface* drawingSurface, IZBuffer* zBuffer, const Vertex* vertices, uint32_t triangleCount) const;
+
+		/**
+		* Draw an indexed list of triangles.
+		* Triangle i uses vertices[indices[3*i]], vertices[indices[3*i+1]] and vertices[indices[3*i+2]];
+		* leftover indices (if indexCount isn't a multiple of 3) are ignored.
+		* Vertices shared between triangles are only transformed once while they stay in a small cache,
+		* so meshes should list triangles that share vertices close together.
+		*
+		* @param[in] drawingSurface The surface to draw into.
+		* @param[in] zBuffer The Z buffer to use. (May be null for no Z buffering)
+		* @param[in] vertices The array of vertices. Every index must be a valid position in it.
+		* @param[in] indices The array of vertex indices.
+		* @param[in] indexCount The number of indices in the array.
+		*
+		* @throws ParameterException if drawingSurface, vertices or indices is NULL.
+		*/
+		virtual void drawIndexed(ISurface* drawingSurface, IZBuffer* zBuffer, const Vertex* vertices, const uint32_t* indices, uint32_t indexCount) const;
+
+		/**
+		* Draw a triangle strip.
+		* Triangle i uses vertices[i], vertices[i+1] and vertices[i+2] (with the first two
+		* swapped for odd i, so that all triangles wind the same way).
+		* Each vertex is only converted to surface coordinates once.
+		* Strips are drawn according to the current render mode.
+		*
+		* @param[in] drawingSurface The surface to draw into.
+		* @param[in] zBuffer The Z buffer to use. (May be null for no Z buffering)
+		* @param[in] vertices The array of vertices in the strip.
+		* @param[in] vertexCount The number of vertices in the array.
+		*
+		* @throws ParameterException if drawingSurface or vertices is NULL, or vertexCount < 3.
+		*/
+		virtual void triangleStrip(ISurface* drawingSurface, IZBuffer* zBuffer, const Vertex* vertices, uint32_t vertexCount) const;
+
+		/**
+		* Draw a triangle fan.
+		* Triangle i uses vertices[0] (the center), vertices[i+1] and vertices[i+2].
+		* Each vertex is only converted to surface coordinates once.
+		* Fans are drawn according to the current render mode.
+		*
+		* @param[in] drawingSurface The surface to draw into.
+		* @param[in] zBuffer The Z buffer to use. (May be null for no Z buffering)
+		* @param[in] vertices The array of vertices in the fan, starting with the center.
+		* @param[in] vertexCount The number of vertices in the array.
+		*
+		* @throws ParameterException if drawingSurface or vertices is NULL, or vertexCount < 3.
+		*/
+		virtual void triangleFan(ISurface* drawingSurface, IZBuffer* zBuffer, const Vertex* vertices, uint32_t vertexCount) const;
+
+		/**
+		* Set the render mode used for triangle batches.
+		* RENDER_MODE_SORT_LAST needs depth to merge by, so batches drawn without a Z buffer
+		* are rendered as in RENDER_MODE_TILED.
+		* It defaults to RENDER_MODE_IMMEDIATE.
+		*
+		* @throws ParameterException if mode is invalid.
+		*/
+		virtual void setRenderMode(RenderMode mode);
+
+		/**
+		* Return the current render mode.
+		*/
+		virtual RenderMode getRenderMode() const;
+
+		/**
+		* Set the raster mode used for triangles and lines.
+		* It defaults to RASTER_MODE_PIXEL.
+		*
+		* @throws ParameterException if mode is invalid.
+		*/
+		virtual void setRasterMode(RasterMode mode);
+
+		/**
+		* Return the current raster mode.
+		*/
+		virtual RasterMode getRasterMode() const;
+
+		/**
+		* Set the cull mode.
+		* Triangles with no area are never drawn, whatever the cull mode.
+		* It defaults to CULL_NONE.
+		*
+		* @throws ParameterException if mode is invalid.
+		*/
+		virtual void setCullMode(CullMode mode);
+
+		/**
+		* Return the current cull mode.
+		*/
+		virtual CullMode getCullMode() const;
+
+		/**
+		* Set which vertex order (as seen with x to the right and y up) makes a triangle front-facing.
+		* It defaults to FRONT_FACE_COUNTER_CLOCKWISE.
+		*
+		* @throws ParameterException if frontFace is invalid.
+		*/
+		virtual void setFrontFace(FrontFace frontFace);
+
+		/**
+		* Return the current front face vertex order.
+		*/
+		virtual FrontFace getFrontFace() const;
+
+		/**
+		* Set the viewport: the rectangle of the drawing surface that vertex coordinates
+		* in [-1.0, 1.0] are mapped onto. Nothing is drawn outside of it.
+		* It defaults to NULL, which means the whole drawing surface.
+		*
+		* @throws ParameterException if viewport has a zero width or height.
+		*/
+		virtual void setViewport(const Rect* viewport);
+
+		/**
+		* Return the current viewport; false if it is the whole drawing surface.
+		*/
+		virtual bool getViewport(Rect& viewport) const;
+
+		/**
+		* Set the scissor rectangle. Triangles and lines only draw pixels inside of it.
+		* It defaults to NULL (i.e. no scissor rectangle).
+		*/
+		virtual void setScissor(const Rect* scissor);
+
+		/**
+		* Return the current scissor rectangle; false if there is none.
+		*/
+		virtual bool getScissor(Rect& scissor) const;
+
+		template <TextureWrappingMode WRAP>
+		Color getTexelbyWrapMode(ISurface * textureMap, float s, float t) const;
+		template <TextureFilteringMode FILTER, TextureWrappingMode WRAP>
+		Color sampleTexture(float S, float T) const;
 
 		/**
 		* Set the texture map to use for drawing triangles.
@@ -120,10 +486,80 @@ namespace ctxgraf {
 		*/
 		virtual TextureFilteringMode getTextureFilteringMode() const;
 
+		/**
+		* Set the function that combines triangle pixels with the pixels already in the drawing surface.
+		* It defaults to BLEND_FUNCTION_NONE.
+		*
+		* @throws ParameterException if function is invalid.
+		*/
+		virtual void setBlendFunction(BlendFunction function);
+
+		/**
+		* Return the current blend function.
+		*/
+		virtual BlendFunction getBlendFunction() const;
+
+		/**
+		* Set the alpha test threshold; triangle pixels with less alpha than this are discarded.
+		* It defaults to 0 (i.e. no alpha test).
+		*/
+		virtual void setAlphaTestThreshold(uint8_t threshold);
+
+		/**
+		* Return the current alpha test threshold.
+		*/
+		virtual uint8_t getAlphaTestThreshold() const;
+
 		//my functions
 		virtual void drawLine(ISurface* drawingSurface, Vertex vA, Vertex vB) const;
+		int64_t placeLineCoordinate(float value, int32_t origin, uint32_t size) const;
+		void setupLine(ISurface* drawingSurface, const Vertex& vA, const Vertex& vB, LineSetup& setup) const;
+		void decimatePolyline(ISurface* drawingSurface, const Vertex* vertices, uint32_t vertexCount, std::vector<uint32_t>& kept) const;
+		void rasterizeLine(ISurface* drawingSurface, const LineSetup& setup, int clipMinX, int clipMinY, int clipMaxX, int clipMaxY) const;
 		Color convertVertexColorToColor(VertexColor vColor) const;
 		void incrementColorBySlope(VertexColor & color, VertexColor slope) const;
+		bool isCulled(float signedArea) const;
+		bool isCulled(const Vertex* v1, const Vertex* v2, const Vertex* v3) const;
+		void transformVertex(ISurface* drawingSurface, const Vertex& vertex, Vertex& transformed) const;
+		Rect getViewportRect(ISurface* drawingSurface) const;
+		bool getClipRect(ISurface* drawingSurface, int& minX, int& minY, int& maxX, int& maxY) const;
+		GuardBand getGuardBand(ISurface* drawingSurface) const;
+		Vertex interpolateVertex(const Vertex& vA, const Vertex& vB, float t) const;
+		uint32_t clipToGuardBand(ISurface* drawingSurface, const GuardBand& band, const Vertex* v1, const Vertex* v2, const Vertex* v3, TriangleSetup* setups) const;
+		uint32_t prepareTriangle(ISurface* drawingSurface, const GuardBand& band, const Vertex* v1, const Vertex* v2, const Vertex* v3, TriangleSetup* setups) const;
+		uint32_t setupTransformedTriangles(ISurface* drawingSurface, TriangleSetup* setups, uint32_t count) const;
+		bool setupTransformedTriangle(ISurface* drawingSurface, TriangleSetup& setup) const;
+#ifdef CTXGRAF_SSE2
+		uint32_t setupFourTriangles(ISurface* drawingSurface, const TriangleSetup* triangles, TriangleSetup* setups) const;
+#endif
+		bool setupFixedTriangle(ISurface* drawingSurface, TriangleSetup& setup) const;
+		void updatePipelineState();
+		template <TextureFilteringMode FILTER>
+		void setFilteredKernels(PipelineState& pipeline) const;
+		template <TextureFilteringMode FILTER, TextureWrappingMode WRAP>
+		void setWrappedKernels(PipelineState& pipeline) const;
+		template <bool TEXTURED, TextureFilteringMode FILTER, TextureWrappingMode WRAP, TextureBlendingMode BLEND>
+		void setKernels(PipelineState& pipeline) const;
+		void rasterizeTriangle(ISurface* drawingSurface, IZBuffer* zBuffer, const TriangleSetup& setup) const;
+		template <bool Z_TEST, bool BLENDED, bool TEXTURED, TextureFilteringMode FILTER, TextureWrappingMode WRAP, TextureBlendingMode BLEND>
+		void rasterizeTriangleGeneric(ISurface* drawingSurface, IZBuffer* zBuffer, const TriangleSetup& setup) const;
+		template <bool Z_TEST, bool BLENDED, bool TEXTURED, TextureFilteringMode FILTER, TextureWrappingMode WRAP, TextureBlendingMode BLEND>
+		void rasterizeTriangleFixed(ISurface* drawingSurface, IZBuffer* zBuffer, const TriangleSetup& setup) const;
+		void blendRow(ISurface* drawingSurface, int y, const BlendRow& row) const;
+#ifdef CTXGRAF_SSE2
+		template <bool Z_TEST, bool FLAT, bool TEXTURED, TextureFilteringMode FILTER, TextureWrappingMode WRAP, TextureBlendingMode BLEND>
+		void rasterizeTriangleSSE2(Surface* colorSurface, Surface* zSurface, const TriangleSetup& setup) const;
+		void fillFlatTriangle(Surface* colorSurface, const TriangleSetup& setup) const;
+#endif
+		template <bool TEXTURED, TextureFilteringMode FILTER, TextureWrappingMode WRAP, TextureBlendingMode BLEND>
+		Color shadePixel(float red, float green, float blue, float alpha, float S, float T) const;
+		BlockCoverage classifyBlock(const TriangleSetup& setup, int minX, int minY, int maxX, int maxY) const;
+		float nearestZ(const TriangleSetup& setup, int minX, int minY, int maxX, int maxY) const;
+		bool clipSetup(const TriangleSetup& setup, int minX, int minY, int maxX, int maxY, TriangleSetup& clipped) const;
+		void drawBatch(ISurface* drawingSurface, IZBuffer* zBuffer, uint32_t triangleCount, const std::function<uint32_t(uint32_t, TriangleSetup*)>& prepareTriangleAt) const;
+		void renderTiled(ISurface* drawingSurface, IZBuffer* zBuffer, const TriangleSetup* setups, uint32_t setupCount) const;
+		void renderSortLast(ISurface* drawingSurface, IZBuffer* zBuffer, const TriangleSetup* setups, uint32_t setupCount) const;
+		void compositeByDepth(ISurface* drawingSurface, IZBuffer* zBuffer, const SortLastTarget& target, int minY, int maxY) const;
 
 	protected:
 
@@ -136,6 +572,19 @@ ISurface* m_textureMap;
 TextureWrappingMode m_wrapMode;
 TextureBlendingMode m_blendMode;
 TextureFilteringMode m_filterMode;
+RenderMode m_renderMode;
+RasterMode m_rasterMode;
+CullMode m_cullMode;
+FrontFace m_frontFace;
+BlendFunction m_blendFunction;
+uint8_t m_alphaTestThreshold;
+bool m_hasViewport;
+Rect m_viewport;
+bool m_hasScissor;
+Rect m_scissor;
+PipelineState m_pipeline;
+mutable std::vector<SortLastTarget> m_sortLastTargets; //kept from batch to batch, so they are only made once
+mutable std::mutex m_sortLastMutex; //keeps threads drawing through the same context off each other's targets
 
 	};
 }
\ No newline at end of file
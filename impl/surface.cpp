@@ -5,37 +5,243 @@
  */
 
 #include "surface.h"
+#include "workerPool.h"
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+// SSE2 is always there on x64, and on x86 whenever the compiler is allowed to use it
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define CTXGRAF_SSE2
+#include <emmintrin.h>
+#endif
 
 
 namespace ctxgraf {
 
+// fillPixels() repeats a pixel out to this many bytes, a multiple of 2, 3 and 4
+// byte pixels and of 16 byte stores, so every row is filled from the same pattern
+static const uint32_t FILL_PATTERN_SIZE = 48;
+
+// Surfaces of at least this many bytes are filled by the worker pool, this many rows per task
+static const uint32_t PARALLEL_FILL_BYTES = 256 * 1024;
+static const uint32_t FILL_BAND_ROWS = 32;
+
+// Spans of PF_RGBA_8888 pixels are copied straight to and from Color arrays
+static_assert(sizeof(Color) == 4, "Color has to be laid out like a PF_RGBA_8888 pixel");
+
+/**
+ * Apply a bitBlt rop to every bit of a source and a destination byte.
+ * Bit (2 * s + d) of the rop is the result for source bit s and destination bit d,
+ * so the result is the OR of the minterms the rop selects.
+ */
+static inline uint8_t applyRop(uint8_t rop, uint8_t s, uint8_t d)
+{
+    uint8_t result = 0;
+    if (rop & 0x1) result |= ~s & ~d;
+    if (rop & 0x2) result |= ~s & d;
+    if (rop & 0x4) result |= s & ~d;
+    if (rop & 0x8) result |= s & d;
+    return result;
+}
+
+#ifdef CTXGRAF_SSE2
+/** applyRop() for 16 bytes at once, with the rop fixed at compile time. */
+template <uint8_t ROP>
+static inline __m128i ropBits(__m128i s, __m128i d)
+{
+    __m128i result = _mm_setzero_si128();
+    if (ROP & 0x1) result = _mm_or_si128(result, _mm_andnot_si128(s, _mm_xor_si128(d, _mm_set1_epi32(-1))));
+    if (ROP & 0x2) result = _mm_or_si128(result, _mm_andnot_si128(s, d));
+    if (ROP & 0x4) result = _mm_or_si128(result, _mm_andnot_si128(d, s));
+    if (ROP & 0x8) result = _mm_or_si128(result, _mm_and_si128(s, d));
+    return result;
+}
+#endif
+
+/** Apply rop ROP to count bytes of a row: dst[i] = rop(src[i], dst[i]). */
+template <uint8_t ROP>
+static void ropRow(uint8_t* dst, const uint8_t* src, uint32_t count)
+{
+    uint32_t i = 0;
+#ifdef CTXGRAF_SSE2
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), ropBits<ROP>(s, d));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = applyRop(ROP, src[i], dst[i]);
+}
+
+typedef void (*RopKernel)(uint8_t* dst, const uint8_t* src, uint32_t count);
+
+static const RopKernel s_ropKernels[16] =
+{
+    ropRow<0x0>, ropRow<0x1>, ropRow<0x2>, ropRow<0x3>,
+    ropRow<0x4>, ropRow<0x5>, ropRow<0x6>, ropRow<0x7>,
+    ropRow<0x8>, ropRow<0x9>, ropRow<0xA>, ropRow<0xB>,
+    ropRow<0xC>, ropRow<0xD>, ropRow<0xE>, ropRow<0xF>,
+};
+
+/**
+ * Repeat the pixelBytes bytes at pixel and at keepMask out to FILL_PATTERN_SIZE bytes
+ * each, with the kept bits cleared from the pattern.  Return true iff any bits are kept.
+ */
+static bool makeFillPattern(const uint8_t* pixel, const uint8_t* keepMask, unsigned pixelBytes,
+                            uint8_t* pattern, uint8_t* keep)
+{
+    bool keeping = false;
+    for (uint32_t i = 0; i < FILL_PATTERN_SIZE; i++)
+    {
+        keep[i] = keepMask[i % pixelBytes];
+        pattern[i] = pixel[i % pixelBytes] & ~keep[i];
+        keeping = keeping || keep[i] != 0;
+    }
+    return keeping;
+}
 
-Surface::Surface(PixelFormat format, uint32_t width, uint32_t height)
-    : m_surface(NULL)
+/**
+ * Fill count bytes at dst from a makeFillPattern() pattern, starting at its first byte,
+ * and leaving alone the bits that are set in keep.
+ */
+static void fillBytes(uint8_t* dst, uint32_t count, const uint8_t* pattern, const uint8_t* keep, bool keeping)
+{
+    uint32_t x = 0;
+#ifdef CTXGRAF_SSE2
+    const __m128i pattern0 = _mm_loadu_si128((const __m128i*)pattern);
+    const __m128i pattern1 = _mm_loadu_si128((const __m128i*)(pattern + 16));
+    const __m128i pattern2 = _mm_loadu_si128((const __m128i*)(pattern + 32));
+    if (keeping)
+    {
+        const __m128i keep0 = _mm_loadu_si128((const __m128i*)keep);
+        const __m128i keep1 = _mm_loadu_si128((const __m128i*)(keep + 16));
+        const __m128i keep2 = _mm_loadu_si128((const __m128i*)(keep + 32));
+        for (; x + FILL_PATTERN_SIZE <= count; x += FILL_PATTERN_SIZE)
+        {
+            __m128i* loc = (__m128i*)(dst + x);
+            _mm_storeu_si128(loc, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(loc), keep0), pattern0));
+            _mm_storeu_si128(loc + 1, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(loc + 1), keep1), pattern1));
+            _mm_storeu_si128(loc + 2, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(loc + 2), keep2), pattern2));
+        }
+    }
+    else
+    {
+        for (; x + FILL_PATTERN_SIZE <= count; x += FILL_PATTERN_SIZE)
+        {
+            __m128i* loc = (__m128i*)(dst + x);
+            _mm_storeu_si128(loc, pattern0);
+            _mm_storeu_si128(loc + 1, pattern1);
+            _mm_storeu_si128(loc + 2, pattern2);
+        }
+    }
+
+    // Less than one whole pattern is left; x is a multiple of FILL_PATTERN_SIZE here
+    if (x + 16 <= count)
+    {
+        const __m128i* keepLoc = (const __m128i*)keep;
+        for (const __m128i* patternLoc = (const __m128i*)pattern; x + 16 <= count; x += 16, patternLoc++, keepLoc++)
+        {
+            __m128i* loc = (__m128i*)(dst + x);
+            _mm_storeu_si128(loc, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(loc), _mm_loadu_si128(keepLoc)),
+                                               _mm_loadu_si128(patternLoc)));
+        }
+    }
+#else
+    (void)keeping; // only picks the SSE2 loop; the byte loop below handles both cases
+#endif
+    for (; x < count; x++)
+        dst[x] = (dst[x] & keep[x % FILL_PATTERN_SIZE]) | pattern[x % FILL_PATTERN_SIZE];
+}
+
+
+Surface::Surface(PixelFormat format, uint32_t width, uint32_t height, SurfaceLayout layout)
+    : m_allocation(NULL)
+    , m_surface(NULL)
     , m_format(format)
+    , m_layout(layout)
     , m_width(width)
     , m_height(height)
     , m_pitch(0)
+    , m_pixelBytes(0)
+    , m_tilesX(0)
+    , m_locked(false)
+    , m_lockX(0)
+    , m_lockY(0)
+    , m_lockWidth(0)
+    , m_lockHeight(0)
+    , m_hizBlocksX(0)
+    , m_hizTilesX(0)
 {
     if (width == 0 || height == 0)
         throw ParameterException("invalid width or height");
     if (format >= PF_COUNT)
         throw NotImplementedException("unsupported pixel format");
+    if (layout >= SL_COUNT)
+        throw ParameterException("invalid surface layout");
 
-    m_pitch = width * bytesPerPixel();
-    uint32_t size = m_pitch * height;
+    m_pixelBytes = bytesPerPixel();
+    m_pitch = width * m_pixelBytes;
+    if (layout == SL_ALIGNED)
+    {
+        m_pitch = (m_pitch + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
 
-    m_surface = new uint8_t[size];
+        // Over-allocate, then move the start up to the first aligned byte
+        const uint32_t size = m_pitch * height + ROW_PADDING;
+        m_allocation = new uint8_t[size + ROW_ALIGNMENT - 1];
+        m_surface = m_allocation + ((ROW_ALIGNMENT - reinterpret_cast<uintptr_t>(m_allocation) % ROW_ALIGNMENT) % ROW_ALIGNMENT);
+    }
+    else if (layout == SL_TILED)
+    {
+        // getPitch() is the pitch of the row order copies; the tiles themselves
+        // cover whole tiles, past the right and bottom edges if need be
+        m_tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        const uint32_t tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+        m_allocation = new uint8_t[m_tilesX * tilesY * TILE_SIZE * TILE_SIZE * m_pixelBytes];
+        m_surface = m_allocation;
+    }
+    else
+    {
+        m_allocation = new uint8_t[m_pitch * height];
+        m_surface = m_allocation;
+    }
+
+    if (format == PF_Z16)
+    {
+        m_hizBlocksX = (width + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+        m_hizTilesX = (width + HIZ_TILE_SIZE - 1) / HIZ_TILE_SIZE;
+        const uint32_t blocksY = (height + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+        const uint32_t tilesY = (height + HIZ_TILE_SIZE - 1) / HIZ_TILE_SIZE;
+
+        // Surface memory starts out undefined, so everything starts out dirty
+        m_hizBlockMax.assign(m_hizBlocksX * blocksY, 0xFFFF);
+        m_hizBlockDirty.assign(m_hizBlocksX * blocksY, 1);
+        m_hizTileMax.assign(m_hizTilesX * tilesY, 0xFFFF);
+        m_hizTileDirty.assign(m_hizTilesX * tilesY, 1);
+    }
 }
 
 Surface::~Surface()
 {
-    delete[] m_surface;
+    delete[] m_allocation;
 }
 
 void Surface::clear(Color clearColor)
 {
+    if (m_format == PF_RGB_888 || m_format == PF_RGBA_8888)
+    {
+        // Alpha only goes in where there is room for it
+        const uint8_t pixel[4] = { clearColor.red, clearColor.green, clearColor.blue, clearColor.alpha };
+        const uint8_t keepMask[4] = { 0, 0, 0, 0 };
+        fillPixels(pixel, keepMask);
+        return;
+    }
+
+    if (hasHiZ())
+        invalidateHiZ();
+
     for (uint32_t y = 0; y < m_height; y++)
     {
         for (uint32_t x = 0; x < m_width; x++)
@@ -49,10 +255,15 @@ void Surface::drawPixel(uint32_t x, uint32_t y, Color pixelColor)
 {
     if (x < m_width && y < m_height)
     {
-        uint8_t* loc = m_surface + (y * m_pitch) + (x * bytesPerPixel());
+        if (hasHiZ())
+            markZWritten(x, y);
+
+        uint8_t* loc = pixelAddress(x, y);
         *loc++ = pixelColor.red;
         *loc++ = pixelColor.green;
         *loc++ = pixelColor.blue;
+        if (m_format == PF_RGBA_8888)
+            *loc = pixelColor.alpha;
     }
 }
 
@@ -66,14 +277,140 @@ Color Surface::getPixel(uint32_t x, uint32_t y) const
     }
 
     Color result;
-    uint8_t* loc = m_surface + (y * m_pitch) + (x * bytesPerPixel());
+    const uint8_t* loc = pixelAddress(x, y);
     result.red   = *loc++;
     result.green = *loc++;
     result.blue  = *loc++;
+    if (m_format == PF_RGBA_8888)
+        result.alpha = *loc;
 
     return result;
 }
 
+void Surface::drawSpan(uint32_t x, uint32_t y, uint32_t count, const Color* colors)
+{
+    if (!colors)
+        throw ParameterException("NULL colors in drawSpan");
+    if (!clipSpan(x, y, count))
+        return;
+
+    if (m_layout == SL_TILED || (m_format != PF_RGB_888 && m_format != PF_RGBA_8888))
+    {
+        for (uint32_t i = 0; i < count; i++)
+            drawPixel(x + i, y, colors[i]);
+        return;
+    }
+
+    uint8_t* loc = m_surface + (y * m_pitch) + (x * bytesPerPixel());
+    if (m_format == PF_RGBA_8888)
+    {
+        memcpy(loc, colors, count * sizeof(Color));
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++, loc += 3)
+    {
+        loc[0] = colors[i].red;
+        loc[1] = colors[i].green;
+        loc[2] = colors[i].blue;
+    }
+}
+
+void Surface::fillSpan(uint32_t x, uint32_t y, uint32_t count, Color pixelColor)
+{
+    if (!clipSpan(x, y, count))
+        return;
+
+    if (m_layout == SL_TILED || (m_format != PF_RGB_888 && m_format != PF_RGBA_8888))
+    {
+        for (uint32_t i = 0; i < count; i++)
+            drawPixel(x + i, y, pixelColor);
+        return;
+    }
+
+    const uint8_t pixel[4] = { pixelColor.red, pixelColor.green, pixelColor.blue, pixelColor.alpha };
+    const uint8_t keepMask[4] = { 0, 0, 0, 0 };
+    uint8_t pattern[FILL_PATTERN_SIZE];
+    uint8_t keep[FILL_PATTERN_SIZE];
+    const bool keeping = makeFillPattern(pixel, keepMask, bytesPerPixel(), pattern, keep);
+
+    fillBytes(m_surface + (y * m_pitch) + (x * bytesPerPixel()), count * bytesPerPixel(), pattern, keep, keeping);
+}
+
+void Surface::readSpan(uint32_t x, uint32_t y, uint32_t count, Color* colors) const
+{
+    if (!colors)
+        throw ParameterException("NULL colors in readSpan");
+    checkSpan(x, y, count, "readSpan");
+
+    if (m_layout == SL_TILED || (m_format != PF_RGB_888 && m_format != PF_RGBA_8888))
+    {
+        for (uint32_t i = 0; i < count; i++)
+            colors[i] = getPixel(x + i, y);
+        return;
+    }
+
+    const uint8_t* loc = m_surface + (y * m_pitch) + (x * bytesPerPixel());
+    if (m_format == PF_RGBA_8888)
+    {
+        memcpy(colors, loc, count * sizeof(Color));
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++, loc += 3)
+        colors[i] = Color(loc[0], loc[1], loc[2]);
+}
+
+void* Surface::lockRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t& pitch)
+{
+    if (m_locked)
+        throw BadStateException("lockRect called while a rectangle is already locked");
+    if (width == 0 || height == 0 || x >= m_width || y >= m_height ||
+        width > m_width - x || height > m_height - y)
+    {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "illegal rectangle to lockRect: (%u,%u) %ux%u\n", x, y, width, height);
+        throw ParameterException(msg);
+    }
+
+    m_locked = true;
+    m_lockX = x;
+    m_lockY = y;
+    m_lockWidth = width;
+    m_lockHeight = height;
+
+    if (m_layout == SL_TILED)
+    {
+        const uint32_t rowBytes = width * m_pixelBytes;
+        m_lockedCopy.resize(rowBytes * height);
+        for (uint32_t row = 0; row < height; row++)
+            readPixels(x, y + row, width, &m_lockedCopy[row * rowBytes]);
+
+        pitch = rowBytes;
+        return m_lockedCopy.data();
+    }
+
+    pitch = m_pitch;
+    return pixelAddress(x, y);
+}
+
+void Surface::unlockRect()
+{
+    if (!m_locked)
+        return;
+
+    if (m_layout == SL_TILED)
+    {
+        const uint32_t rowBytes = m_lockWidth * m_pixelBytes;
+        for (uint32_t row = 0; row < m_lockHeight; row++)
+            writePixels(m_lockX, m_lockY + row, m_lockWidth, &m_lockedCopy[row * rowBytes]);
+    }
+
+    // Anything in the rectangle may have been written
+    if (hasHiZ())
+        invalidateHiZ(m_lockX, m_lockY, m_lockWidth, m_lockHeight);
+
+    m_locked = false;
+}
+
 
 void Surface::bitBlt(uint32_t width, uint32_t height,
     uint32_t dstX, uint32_t dstY,
@@ -82,10 +419,9 @@ void Surface::bitBlt(uint32_t width, uint32_t height,
 {
     if (rop > 15)
         throw ParameterException("Bad bitBlt rop parameter");
-    if (rop != BITBLT_ROP_SRCCOPY && rop != BITBLT_ROP_BLACKNESS && rop != BITBLT_ROP_DSTINVERT && rop != BITBLT_ROP_WHITENESS)
-        throw NotImplementedException("Unsupported rop");
 
-    const bool srcRequired = (rop == BITBLT_ROP_SRCCOPY);
+    // The rop needs the source unless it gives the same result for both source bit values
+    const bool srcRequired = ((rop >> 2) != (rop & 0x3));
     if (srcRequired && !src)
         throw ParameterException("BitBlt source required, but source parameter is NULL");
 
@@ -115,6 +451,9 @@ void Surface::bitBlt(uint32_t width, uint32_t height,
     else if (height > m_height - dstY)
         height = m_height - dstY;
 
+    if (hasHiZ())
+        invalidateHiZ();
+
     if (srcRequired)
     {
         if (srcX > m_width)
@@ -128,90 +467,98 @@ void Surface::bitBlt(uint32_t width, uint32_t height,
             height = m_height - srcY;
     }
 
-    switch (rop)
+    if (width == 0 || height == 0)
+        return;
+
+    // Same pixel layout on both sides: whole rows at a time. A rop that doesn't
+    // need the source reads the destination in its place (the result is the same).
+    const Surface* srcSurface = (srcRequired ? dynamic_cast<const Surface*>(src) : this);
+    if (!srcRequired)
     {
-    case BITBLT_ROP_SRCCOPY:
-        switch (copyDirection)
+        srcX = dstX;
+        srcY = dstY;
+    }
+
+    if (srcSurface != NULL && srcSurface->m_format == m_format &&
+        srcX + width <= srcSurface->m_width && srcY + height <= srcSurface->m_height)
+    {
+        const unsigned pixelBytes = bytesPerPixel();
+        const uint32_t rowBytes = width * pixelBytes;
+        const RopKernel kernel = s_ropKernels[rop];
+
+        // copyDirection puts the rows in a safe order. Inside a row, left to right is only
+        // unsafe when the destination is to the right of the source on the same rows, so
+        // then each source row is set aside first (memmove() does that on its own).
+        // Rows of tiled surfaces aren't contiguous, so they always go through copies.
+        const bool tiled = (m_layout == SL_TILED || srcSurface->m_layout == SL_TILED);
+        std::vector<uint8_t> rowCopy(copyDirection == CD_RIGHT_TO_LEFT || tiled ? rowBytes : 0);
+        std::vector<uint8_t> dstCopy(tiled ? rowBytes : 0);
+
+        for (uint32_t i = 0; i < height; i++)
         {
-        case CD_TOP_TO_BOTTOM:
-            for (uint32_t y = 0; y < height; y++)
+            const uint32_t y = (copyDirection == CD_BOTTOM_TO_TOP ? height - 1 - i : i);
+            if (tiled)
             {
-                for (uint32_t x = 0; x < width; x++)
+                srcSurface->readPixels(srcX, srcY + y, width, rowCopy.data());
+                if (rop != BITBLT_ROP_SRCCOPY)
                 {
-                    drawPixel(dstX + x, dstY + y, src->getPixel(srcX + x, srcY + y));
+                    readPixels(dstX, dstY + y, width, dstCopy.data());
+                    kernel(dstCopy.data(), rowCopy.data(), rowBytes);
+                    rowCopy.swap(dstCopy);
                 }
+                writePixels(dstX, dstY + y, width, rowCopy.data());
+                continue;
             }
-            break;
 
-        case CD_BOTTOM_TO_TOP:
-            for (int32_t y = height - 1; y >= 0; y--)
-            {
-                for (uint32_t x = 0; x < width; x++)
-                {
-                    drawPixel(dstX + x, dstY + y, src->getPixel(srcX + x, srcY + y));
-                }
-            }
-            break;
+            uint8_t* dstRow = m_surface + ((dstY + y) * m_pitch) + (dstX * pixelBytes);
+            const uint8_t* srcRow = srcSurface->m_surface + ((srcY + y) * srcSurface->m_pitch) + (srcX * pixelBytes);
 
-        case CD_RIGHT_TO_LEFT:
-            for (uint32_t y = 0; y < height; y++)
+            if (rop == BITBLT_ROP_SRCCOPY)
             {
-                for (int32_t x = width - 1; x >= 0; x--)
-                {
-                    drawPixel(dstX + x, dstY + y, src->getPixel(srcX + x, srcY + y));
-                }
+                memmove(dstRow, srcRow, rowBytes);
+                continue;
             }
-            break;
-
-        default:
-            throw BadStateException("Bad CopyDirection");
-        }
-        break;
-
-    case BITBLT_ROP_BLACKNESS:
-    case BITBLT_ROP_WHITENESS:
-    {
-        const Color color = (rop == BITBLT_ROP_BLACKNESS ? Color(0, 0, 0) : Color(255, 255, 255));
-
-        for (uint32_t y = 0; y < height; y++)
-        {
-            for (uint32_t x = 0; x < width; x++)
+            if (!rowCopy.empty())
             {
-                drawPixel(dstX + x, dstY + y, color);
+                memcpy(rowCopy.data(), srcRow, rowBytes);
+                srcRow = rowCopy.data();
             }
+            kernel(dstRow, srcRow, rowBytes);
         }
-        break;
+        return;
     }
 
-    case BITBLT_ROP_DSTINVERT:
+    // Anything else goes pixel by pixel through the interfaces. The source is a
+    // different surface here, so the order doesn't matter.
+    for (uint32_t y = 0; y < height; y++)
     {
-        for (uint32_t y = 0; y < height; y++)
+        for (uint32_t x = 0; x < width; x++)
         {
-            for (uint32_t x = 0; x < width; x++)
-            {
-                Color dstColor = getPixel(dstX + x, dstY + y);
-                dstColor.red   = ~dstColor.red;
-                dstColor.green = ~dstColor.green;
-                dstColor.blue  = ~dstColor.blue;
-                drawPixel(dstX + x, dstY + y, dstColor);
-            }
+            const Color srcColor = src->getPixel(srcX + x, srcY + y);
+            const Color dstColor = getPixel(dstX + x, dstY + y);
+            Color result(applyRop(rop, srcColor.red, dstColor.red),
+                         applyRop(rop, srcColor.green, dstColor.green),
+                         applyRop(rop, srcColor.blue, dstColor.blue));
+            result.alpha = applyRop(rop, srcColor.alpha, dstColor.alpha);
+            drawPixel(dstX + x, dstY + y, result);
         }
-        break;
-    }
-
-    default:
-        throw BadStateException("Illegal rop in switch");
     }
 }
 
 void* Surface::getStart()
 {
-    return static_cast<void*>(m_surface);
+    return const_cast<void*>(static_cast<const Surface*>(this)->getStart());
 }
 
 const void* Surface::getStart() const
 {
-    return static_cast<const void*>(m_surface);
+    if (m_layout != SL_TILED)
+        return static_cast<const void*>(m_surface);
+
+    m_linearCopy.resize(m_pitch * m_height);
+    for (uint32_t y = 0; y < m_height; y++)
+        readPixels(0, y, m_width, &m_linearCopy[y * m_pitch]);
+    return static_cast<const void*>(m_linearCopy.data());
 }
 
 uint32_t Surface::getWidth() const
@@ -234,15 +581,43 @@ PixelFormat Surface::getFormat() const
     return m_format;
 }
 
+SurfaceLayout Surface::getLayout() const
+{
+    return m_layout;
+}
+
 void Surface::clear(uint32_t clearValue)
 {
-    for (uint32_t y = 0; y < m_height; y++)
+    if (m_format == PF_Z16)
     {
-        for (uint32_t x = 0; x < m_width; x++)
+        if (clearValue > 0xFFFF)
+            throw ParameterException("Z value is too big in clear");
+
+        const uint16_t zValue = static_cast<uint16_t>(clearValue);
+        uint8_t pixel[2];
+        const uint8_t keepMask[2] = { 0, 0 };
+        memcpy(pixel, &zValue, sizeof(zValue));
+        fillPixels(pixel, keepMask);
+    }
+    else
+    {
+        for (uint32_t y = 0; y < m_height; y++)
         {
-            setZ(x, y, clearValue);
+            for (uint32_t x = 0; x < m_width; x++)
+            {
+                setZ(x, y, clearValue);
+            }
         }
     }
+
+    // Every block and tile now holds exactly clearValue
+    if (hasHiZ())
+    {
+        std::fill(m_hizBlockMax.begin(), m_hizBlockMax.end(), static_cast<uint16_t>(clearValue));
+        std::fill(m_hizBlockDirty.begin(), m_hizBlockDirty.end(), 0);
+        std::fill(m_hizTileMax.begin(), m_hizTileMax.end(), static_cast<uint16_t>(clearValue));
+        std::fill(m_hizTileDirty.begin(), m_hizTileDirty.end(), 0);
+    }
 }
 
 void Surface::setZ(uint32_t x, uint32_t y, uint32_t zValue)
@@ -252,8 +627,29 @@ void Surface::setZ(uint32_t x, uint32_t y, uint32_t zValue)
     if (zValue > 0xFFFF)
         throw ParameterException("Z value is too big in setZ");
 
-    uint16_t* loc = (uint16_t*)(m_surface + (y * m_pitch) + (x * bytesPerPixel()));
+    uint16_t* loc = (uint16_t*)pixelAddress(x, y);
+    const uint32_t oldValue = *loc;
     *loc = zValue;
+
+    if (hasHiZ())
+    {
+        const uint32_t block = (y / HIZ_BLOCK_SIZE) * m_hizBlocksX + (x / HIZ_BLOCK_SIZE);
+        const uint32_t tile = (y / HIZ_TILE_SIZE) * m_hizTilesX + (x / HIZ_TILE_SIZE);
+
+        if (zValue > m_hizBlockMax[block])
+        {
+            // Raising the max keeps it exact (or at least an upper bound)
+            m_hizBlockMax[block] = zValue;
+            if (zValue > m_hizTileMax[tile])
+                m_hizTileMax[tile] = zValue;
+        }
+        else if (oldValue == m_hizBlockMax[block] && zValue < oldValue)
+        {
+            // The max may have just come down; find out the next time somebody asks
+            m_hizBlockDirty[block] = 1;
+            m_hizTileDirty[tile] = 1;
+        }
+    }
 }
 
 uint32_t Surface::getZ(uint32_t x, uint32_t y) const
@@ -265,10 +661,122 @@ uint32_t Surface::getZ(uint32_t x, uint32_t y) const
         throw ParameterException(msg);
     }
 
-    uint16_t* loc = (uint16_t*)(m_surface + (y * m_pitch) + (x * bytesPerPixel()));
+    const uint16_t* loc = (const uint16_t*)pixelAddress(x, y);
     return *loc;
 }
 
+void Surface::setZSpan(uint32_t x, uint32_t y, uint32_t count, const uint32_t* zValues)
+{
+    if (!zValues)
+        throw ParameterException("NULL zValues in setZSpan");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (zValues[i] > 0xFFFF)
+            throw ParameterException("Z value is too big in setZSpan");
+    }
+    if (!clipSpan(x, y, count))
+        return;
+
+    for (uint32_t i = 0; i < count; i++)
+        *(uint16_t*)pixelAddress(x + i, y) = static_cast<uint16_t>(zValues[i]);
+
+    if (hasHiZ())
+        invalidateHiZ(x, y, count, 1);
+}
+
+void Surface::getZSpan(uint32_t x, uint32_t y, uint32_t count, uint32_t* zValues) const
+{
+    if (!zValues)
+        throw ParameterException("NULL zValues in getZSpan");
+    checkSpan(x, y, count, "getZSpan");
+
+    for (uint32_t i = 0; i < count; i++)
+        zValues[i] = *(const uint16_t*)pixelAddress(x + i, y);
+}
+
+uint32_t Surface::getBlockMaxZ(uint32_t x, uint32_t y)
+{
+    const uint32_t blockX = x / HIZ_BLOCK_SIZE, blockY = y / HIZ_BLOCK_SIZE;
+    const uint32_t block = blockY * m_hizBlocksX + blockX;
+
+    if (m_hizBlockDirty[block])
+        recomputeBlockMaxZ(blockX, blockY);
+
+    return m_hizBlockMax[block];
+}
+
+uint32_t Surface::getTileMaxZ(uint32_t x, uint32_t y)
+{
+    const uint32_t tileX = x / HIZ_TILE_SIZE, tileY = y / HIZ_TILE_SIZE;
+    const uint32_t tile = tileY * m_hizTilesX + tileX;
+
+    if (m_hizTileDirty[tile])
+    {
+        // A tile's max is the max of its blocks' maxes
+        const uint32_t blocksPerTile = HIZ_TILE_SIZE / HIZ_BLOCK_SIZE;
+        const uint32_t blocksY = static_cast<uint32_t>(m_hizBlockMax.size()) / m_hizBlocksX;
+        const uint32_t lastBlockX = std::min((tileX + 1) * blocksPerTile, m_hizBlocksX);
+        const uint32_t lastBlockY = std::min((tileY + 1) * blocksPerTile, blocksY);
+
+        uint32_t tileMax = 0;
+        for (uint32_t blockY = tileY * blocksPerTile; blockY < lastBlockY; blockY++)
+        {
+            for (uint32_t blockX = tileX * blocksPerTile; blockX < lastBlockX; blockX++)
+            {
+                const uint32_t block = blockY * m_hizBlocksX + blockX;
+                if (m_hizBlockDirty[block])
+                    recomputeBlockMaxZ(blockX, blockY);
+                tileMax = std::max(tileMax, static_cast<uint32_t>(m_hizBlockMax[block]));
+            }
+        }
+
+        m_hizTileMax[tile] = static_cast<uint16_t>(tileMax);
+        m_hizTileDirty[tile] = 0;
+    }
+
+    return m_hizTileMax[tile];
+}
+
+void Surface::invalidateHiZ()
+{
+    std::fill(m_hizBlockDirty.begin(), m_hizBlockDirty.end(), 1);
+    std::fill(m_hizTileDirty.begin(), m_hizTileDirty.end(), 1);
+}
+
+void Surface::invalidateHiZ(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    const uint32_t lastX = x + width - 1, lastY = y + height - 1;
+
+    for (uint32_t blockY = y / HIZ_BLOCK_SIZE; blockY <= lastY / HIZ_BLOCK_SIZE; blockY++)
+    {
+        for (uint32_t blockX = x / HIZ_BLOCK_SIZE; blockX <= lastX / HIZ_BLOCK_SIZE; blockX++)
+            m_hizBlockDirty[blockY * m_hizBlocksX + blockX] = 1;
+    }
+    for (uint32_t tileY = y / HIZ_TILE_SIZE; tileY <= lastY / HIZ_TILE_SIZE; tileY++)
+    {
+        for (uint32_t tileX = x / HIZ_TILE_SIZE; tileX <= lastX / HIZ_TILE_SIZE; tileX++)
+            m_hizTileDirty[tileY * m_hizTilesX + tileX] = 1;
+    }
+}
+
+void Surface::recomputeBlockMaxZ(uint32_t blockX, uint32_t blockY)
+{
+    const uint32_t firstX = blockX * HIZ_BLOCK_SIZE, firstY = blockY * HIZ_BLOCK_SIZE;
+    const uint32_t lastX = std::min(firstX + HIZ_BLOCK_SIZE, m_width);
+    const uint32_t lastY = std::min(firstY + HIZ_BLOCK_SIZE, m_height);
+
+    uint16_t blockMax = 0;
+    for (uint32_t y = firstY; y < lastY; y++)
+    {
+        for (uint32_t x = firstX; x < lastX; x++)
+            blockMax = std::max(blockMax, *(const uint16_t*)pixelAddress(x, y));
+    }
+
+    const uint32_t block = blockY * m_hizBlocksX + blockX;
+    m_hizBlockMax[block] = blockMax;
+    m_hizBlockDirty[block] = 0;
+}
+
 unsigned Surface::bytesPerPixel() const
 {
     switch (m_format)
@@ -285,6 +793,85 @@ unsigned Surface::bytesPerPixel() const
     }
 }
 
+void Surface::fillPixels(const uint8_t* pixel, const uint8_t* keepMask)
+{
+    uint8_t pattern[FILL_PATTERN_SIZE];
+    uint8_t keep[FILL_PATTERN_SIZE];
+    const bool keeping = makeFillPattern(pixel, keepMask, bytesPerPixel(), pattern, keep);
+
+    // Aligned rows are padded out to a multiple of 16 bytes, so they can be finished
+    // with whole stores. A tiled surface is filled a row of tiles at a time.
+    uint32_t rowBytes = m_width * m_pixelBytes;
+    uint32_t rowPitch = m_pitch;
+    uint32_t rowCount = m_height;
+    if (m_layout == SL_ALIGNED)
+        rowBytes = (rowBytes + 15) & ~15u;
+    else if (m_layout == SL_TILED)
+    {
+        rowBytes = rowPitch = m_tilesX * TILE_SIZE * TILE_SIZE * m_pixelBytes;
+        rowCount = (m_height + TILE_SIZE - 1) / TILE_SIZE;
+    }
+
+    auto fillBand = [&](uint32_t band)
+    {
+        const uint32_t lastRow = std::min((band + 1) * FILL_BAND_ROWS, rowCount);
+        for (uint32_t row = band * FILL_BAND_ROWS; row < lastRow; row++)
+            fillBytes(m_surface + (row * rowPitch), rowBytes, pattern, keep, keeping);
+    };
+
+    const uint32_t bandCount = (rowCount + FILL_BAND_ROWS - 1) / FILL_BAND_ROWS;
+    if (rowPitch * rowCount >= PARALLEL_FILL_BYTES)
+        WorkerPool::instance().parallelFor(bandCount, fillBand);
+    else
+    {
+        for (uint32_t band = 0; band < bandCount; band++)
+            fillBand(band);
+    }
+}
+
+void Surface::readPixels(uint32_t x, uint32_t y, uint32_t count, uint8_t* bytes) const
+{
+    if (m_layout != SL_TILED)
+    {
+        memcpy(bytes, pixelAddress(x, y), count * m_pixelBytes);
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++, bytes += m_pixelBytes)
+        memcpy(bytes, pixelAddress(x + i, y), m_pixelBytes);
+}
+
+void Surface::writePixels(uint32_t x, uint32_t y, uint32_t count, const uint8_t* bytes)
+{
+    if (m_layout != SL_TILED)
+    {
+        memcpy(pixelAddress(x, y), bytes, count * m_pixelBytes);
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++, bytes += m_pixelBytes)
+        memcpy(pixelAddress(x + i, y), bytes, m_pixelBytes);
+}
+
+bool Surface::clipSpan(uint32_t x, uint32_t y, uint32_t& count) const
+{
+    if (count == 0 || x >= m_width || y >= m_height)
+        return false;
+
+    count = std::min(count, m_width - x);
+    return true;
+}
+
+void Surface::checkSpan(uint32_t x, uint32_t y, uint32_t count, const char* method) const
+{
+    if (x >= m_width || y >= m_height || count > m_width - x)
+    {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "illegal span to %s: (%u,%u) count %u\n", method, x, y, count);
+        throw ParameterException(msg);
+    }
+}
+
 /*static*/
 bool Surface::rectanglesOverlap(uint32_t width, uint32_t height,
                                 uint32_t dstX, uint32_t dstY,
@@ -2,6 +2,7 @@
 #define SURFACE_H_INCLUDED
 
 #include "ctxgraf_pub.h"
+#include <vector>
 
 
 namespace ctxgraf
@@ -11,13 +12,18 @@ class Surface: public ISurface, public IZBuffer
 {
 public:
 
-    Surface(PixelFormat format, uint32_t width, uint32_t height);
+    Surface(PixelFormat format, uint32_t width, uint32_t height, SurfaceLayout layout = SL_PACKED);
     virtual ~Surface();
 
     // ISurface methods
     virtual void clear(Color clearColor);
     virtual void drawPixel(uint32_t x, uint32_t y, Color pixelColor);
     virtual Color getPixel(uint32_t x, uint32_t y) const;
+    virtual void drawSpan(uint32_t x, uint32_t y, uint32_t count, const Color* colors);
+    virtual void fillSpan(uint32_t x, uint32_t y, uint32_t count, Color pixelColor);
+    virtual void readSpan(uint32_t x, uint32_t y, uint32_t count, Color* colors) const;
+    virtual void* lockRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t& pitch);
+    virtual void unlockRect();
     virtual void bitBlt(uint32_t width, uint32_t height,
                         uint32_t dstX, uint32_t dstY,
                         const ISurface* src, uint32_t srcX, uint32_t srcY,
@@ -28,23 +34,161 @@ public:
     virtual uint32_t getHeight() const;
     virtual uint32_t getPitch() const;
     virtual PixelFormat getFormat() const;
+    virtual SurfaceLayout getLayout() const;
 
     // Extra IZBuffer methods
     virtual void clear(uint32_t clearValue);
     virtual void setZ(uint32_t x, uint32_t y, uint32_t zValue);
     virtual uint32_t getZ(uint32_t x, uint32_t y) const;
+    virtual void setZSpan(uint32_t x, uint32_t y, uint32_t count, const uint32_t* zValues);
+    virtual void getZSpan(uint32_t x, uint32_t y, uint32_t count, uint32_t* zValues) const;
+
+    // SL_ALIGNED surfaces start every row on a ROW_ALIGNMENT byte boundary, and
+    // have ROW_PADDING more bytes after the last row, so that vector code can
+    // run a little past the end of any row.
+    static const uint32_t ROW_ALIGNMENT = 64;
+    static const uint32_t ROW_PADDING = 64;
+
+    // SL_TILED surfaces keep their pixels in TILE_SIZE square tiles, one after
+    // another across each row of tiles, with the pixels of a tile in Morton (Z)
+    // order. A texel fetch from a rotated or shrunken texture then usually lands
+    // in a cache line that the last few fetches already brought in.
+    static const uint32_t TILE_SIZE = 8;
+
+    /**
+     * Return the index of the pixel at (x,y) in a tiled surface that is tilesX
+     * tiles wide.
+     */
+    static uint32_t tiledPixelIndex(uint32_t x, uint32_t y, uint32_t tilesX)
+    {
+        // Interleave the low 3 bits of x and y: x0 y0 x1 y1 x2 y2, lowest bit first
+        const uint32_t morton = (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) | ((x & 4) << 2) | ((y & 4) << 3);
+        return ((y / TILE_SIZE) * tilesX + (x / TILE_SIZE)) * (TILE_SIZE * TILE_SIZE) + morton;
+    }
+
+    /** Return the address of the pixel at (x,y), which must be inside the surface. */
+    uint8_t* pixelAddress(uint32_t x, uint32_t y) const
+    {
+        if (m_layout == SL_TILED)
+            return m_surface + tiledPixelIndex(x, y, m_tilesX) * m_pixelBytes;
+        return m_surface + (y * m_pitch) + (x * m_pixelBytes);
+    }
+
+    /**
+     * getPixel() without the virtual call or the bounds check, for code that
+     * reads a lot of pixels: (x,y) must be inside the surface.
+     */
+    Color readPixel(uint32_t x, uint32_t y) const
+    {
+        const uint8_t* loc = pixelAddress(x, y);
+        Color result(loc[0], loc[1], loc[2]);
+        if (m_format == PF_RGBA_8888)
+            result.alpha = loc[3];
+        return result;
+    }
+
+    // Hierarchical Z
+    //
+    // PF_Z16 surfaces keep the largest Z value of every HIZ_BLOCK_SIZE square
+    // block, and of every HIZ_TILE_SIZE square tile, so that a rasterizer can
+    // throw away a whole block whose nearest Z can't pass the depth test.
+    // Writes through setZ(), setZSpan(), lockRect() and clear() keep these up
+    // to date; code that writes Z values straight into surface memory must
+    // call markZWritten().
+
+    static const uint32_t HIZ_BLOCK_SIZE = 8;
+    static const uint32_t HIZ_TILE_SIZE = 64;
+
+    /** Return true iff this surface keeps hierarchical Z data. */
+    bool hasHiZ() const { return !m_hizBlockMax.empty(); }
+
+    /**
+     * Return the largest Z value in the block containing (x,y).
+     * (x,y) must be inside the surface, and hasHiZ() must be true.
+     */
+    uint32_t getBlockMaxZ(uint32_t x, uint32_t y);
+
+    /**
+     * Return an upper bound on the Z values in the tile containing (x,y).
+     * (x,y) must be inside the surface, and hasHiZ() must be true.
+     */
+    uint32_t getTileMaxZ(uint32_t x, uint32_t y);
+
+    /** Note that the Z value at (x,y) was changed without going through setZ(). */
+    void markZWritten(uint32_t x, uint32_t y)
+    {
+        m_hizBlockDirty[(y / HIZ_BLOCK_SIZE) * m_hizBlocksX + (x / HIZ_BLOCK_SIZE)] = 1;
+        m_hizTileDirty[(y / HIZ_TILE_SIZE) * m_hizTilesX + (x / HIZ_TILE_SIZE)] = 1;
+    }
 
 protected:
 
+    uint8_t* m_allocation;
     uint8_t* m_surface;
     PixelFormat m_format;
+    SurfaceLayout m_layout;
     uint32_t m_width;
     uint32_t m_height;
     uint32_t m_pitch;
+    uint32_t m_pixelBytes;  // bytesPerPixel(), kept for pixelAddress()
+    uint32_t m_tilesX;      // tiles across each row of tiles, if m_layout is SL_TILED
 
     /** Return the bytes per pixel required by this object's pixel format (m_format) */
     unsigned bytesPerPixel() const;
 
+    /** Copy the raw bytes of the count pixels starting at (x,y) and going right to bytes. */
+    void readPixels(uint32_t x, uint32_t y, uint32_t count, uint8_t* bytes) const;
+
+    /** Copy the raw bytes of the count pixels starting at (x,y) and going right from bytes. */
+    void writePixels(uint32_t x, uint32_t y, uint32_t count, const uint8_t* bytes);
+
+    /**
+     * Set every pixel to the bytesPerPixel() bytes at pixel, leaving alone the
+     * bits of each pixel that are set in keepMask (also bytesPerPixel() bytes).
+     * Rows are written 16 bytes at a time, and big surfaces are split across
+     * the worker pool.
+     */
+    void fillPixels(const uint8_t* pixel, const uint8_t* keepMask);
+
+    // The rectangle handed out by lockRect(), if m_locked
+    bool m_locked;
+    uint32_t m_lockX;
+    uint32_t m_lockY;
+    uint32_t m_lockWidth;
+    uint32_t m_lockHeight;
+
+    // Row order copies of an SL_TILED surface, handed out by getStart() and lockRect()
+    mutable std::vector<uint8_t> m_linearCopy;
+    std::vector<uint8_t> m_lockedCopy;
+
+    /**
+     * Clip the span of count pixels starting at (x,y) to the surface.
+     * Return false if nothing is left, otherwise set count to the number of pixels left.
+     */
+    bool clipSpan(uint32_t x, uint32_t y, uint32_t& count) const;
+
+    /** Throw a ParameterException naming method unless the whole span is inside the surface. */
+    void checkSpan(uint32_t x, uint32_t y, uint32_t count, const char* method) const;
+
+    // Hierarchical Z data (empty unless m_format is PF_Z16).
+    // A block or tile that isn't dirty has a max that is at least as big as
+    // every Z value it covers; a dirty one is recomputed before it is used.
+    uint32_t m_hizBlocksX;
+    uint32_t m_hizTilesX;
+    std::vector<uint16_t> m_hizBlockMax;
+    std::vector<uint8_t> m_hizBlockDirty;
+    std::vector<uint16_t> m_hizTileMax;
+    std::vector<uint8_t> m_hizTileDirty;
+
+    /** Mark every block and tile dirty, e.g. after an unknown change to the Z values. */
+    void invalidateHiZ();
+
+    /** Mark every block and tile touching the given rectangle dirty. */
+    void invalidateHiZ(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+    /** Recompute the max of the block at block coordinates (blockX, blockY). */
+    void recomputeBlockMaxZ(uint32_t blockX, uint32_t blockY);
+
     /** Return true iff the two given rectangles overlap. */
     static bool rectanglesOverlap(uint32_t width, uint32_t height,
                                   uint32_t dstX, uint32_t dstY,
@@ -20,9 +20,10 @@
 namespace ctxgraf {
 
 
-ISurface* Top::createSurface(PixelFormat format, uint32_t width, uint32_t height)
+ISurface* Top::createSurface(PixelFormat format, uint32_t width, uint32_t height,
+                             SurfaceLayout layout)
 {
-    return new Surface(format, width, height);
+    return new Surface(format, width, height, layout);
 }
 
 IDrawingContext* Top::createDrawingContext()
@@ -30,9 +31,9 @@ IDrawingContext* Top::createDrawingContext()
     return new DrawingContext();
 }
 
-IZBuffer* Top::createZBuffer(uint32_t width, uint32_t height)
+IZBuffer* Top::createZBuffer(uint32_t width, uint32_t height, SurfaceLayout layout)
 {
-    return new Surface(PF_Z16, width, height);
+    return new Surface(PF_Z16, width, height, layout);
 }
 
 static ITop* s_top = NULL;
@@ -0,0 +1,139 @@
+/**
+ * Concordia University CSC3308
+ *
+ * Author: Hunter Barton
+ */
+
+/**
+ * @file workerPool.cpp
+ *
+ * This file contains the implementation of the WorkerPool class.
+ */
+
+#include "workerPool.h"
+#include <algorithm>
+
+
+namespace ctxgraf {
+
+/** True on threads that are currently running a parallelFor() task. */
+static thread_local bool s_inTask = false;
+
+
+WorkerPool& WorkerPool::instance()
+{
+    static WorkerPool s_pool(std::max(std::thread::hardware_concurrency(), 1u));
+    return s_pool;
+}
+
+WorkerPool::WorkerPool(uint32_t threadCount)
+    : m_task(nullptr)
+    , m_count(0)
+    , m_next(0)
+    , m_generation(0)
+    , m_busy(0)
+    , m_stopping(false)
+{
+    // The caller of parallelFor() is one of the threads
+    for (uint32_t i = 1; i < threadCount; i++)
+        m_threads.push_back(std::thread(&WorkerPool::workerMain, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (std::thread& thread : m_threads)
+        thread.join();
+}
+
+void WorkerPool::parallelFor(uint32_t count, const std::function<void(uint32_t)>& task)
+{
+    if (count == 0)
+        return;
+
+    // Nested, single-item and single-thread jobs aren't worth waking anybody for
+    if (s_inTask || count == 1 || m_threads.empty())
+    {
+        for (uint32_t i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    std::lock_guard<std::mutex> submitLock(m_submitMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_count = count;
+        m_next = 0;
+        m_error = nullptr;
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    runTasks();
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this] { return m_busy == 0; });
+        m_task = nullptr;
+        error = m_error;
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void WorkerPool::workerMain()
+{
+    uint64_t seenGeneration = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stopping || (m_task && m_generation != seenGeneration); });
+            if (m_stopping)
+                return;
+            seenGeneration = m_generation;
+            m_busy++;
+        }
+
+        runTasks();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_busy--;
+        }
+        m_idle.notify_all();
+    }
+}
+
+void WorkerPool::runTasks()
+{
+    s_inTask = true;
+
+    for (uint32_t i = m_next++; i < m_count; i = m_next++)
+    {
+        try
+        {
+            (*m_task)(i);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_error)
+                m_error = std::current_exception();
+        }
+    }
+
+    s_inTask = false;
+}
+
+} // namespace ctxgraf
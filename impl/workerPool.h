@@ -0,0 +1,84 @@
+/**
+ * Concordia University CSC3308
+ *
+ * Author: Hunter Barton
+ */
+
+#ifndef WORKER_POOL_H_INCLUDED
+#define WORKER_POOL_H_INCLUDED
+
+/**
+ * @file workerPool.h
+ *
+ * This file contains the definition of the WorkerPool class, a small fixed-size
+ * thread pool used to spread rendering work across cores.
+ */
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace ctxgraf {
+
+class WorkerPool
+{
+public:
+
+    /**
+     * Return the process-wide pool, creating it on first use.
+     * The pool has one thread per hardware thread, counting the caller.
+     */
+    static WorkerPool& instance();
+
+    ~WorkerPool();
+
+    /** Return the number of threads that run tasks, including the calling thread. */
+    uint32_t getThreadCount() const { return static_cast<uint32_t>(m_threads.size()) + 1; }
+
+    /**
+     * Call task(i) once for every i in [0, count), spread across the pool, and
+     * return when all calls have finished.  The calling thread takes part.
+     * Calls made from inside a task run serially on that task's thread.
+     *
+     * @throws whatever the first failing task threw, after all tasks are done.
+     */
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)>& task);
+
+private:
+
+    explicit WorkerPool(uint32_t threadCount);
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /** Main loop of each pool thread. */
+    void workerMain();
+
+    /** Pull task indices from the current job until there are none left. */
+    void runTasks();
+
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_submitMutex;       ///< serializes parallelFor() callers
+    std::mutex m_mutex;             ///< protects the job fields below
+    std::condition_variable m_wake; ///< signalled when a job starts or the pool stops
+    std::condition_variable m_idle; ///< signalled when the last worker leaves a job
+
+    const std::function<void(uint32_t)>* m_task;
+    uint32_t m_count;
+    std::atomic<uint32_t> m_next;
+    uint64_t m_generation;
+    uint32_t m_busy;
+    bool m_stopping;
+    std::exception_ptr m_error;
+};
+
+} // namespace ctxgraf
+
+#endif // WORKER_POOL_H_INCLUDED